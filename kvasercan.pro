@@ -9,10 +9,32 @@ DESTDIR = $$(QTDIR)/plugins/canbus
 
 HEADERS += \
     kvasercanbackend.h \
+    kvasercanbackend_p.h \
+    kvasercancache_p.h \
+    kvasercancapture_p.h \
+    kvasercancommon_p.h \
+    kvasercanfilter_p.h \
+    kvasercanperiodic_p.h \
+    kvasercanidtable_p.h \
+    kvasercanprofiler_p.h \
+    kvasercanreplay_p.h \
+    kvasercanresponder_p.h \
+    kvasercansupervisor_p.h \
+    kvasercantiming_p.h \
+    kvasercan_constants_p.h \
     kvasercan_symbols_p.h
 
 SOURCES += \
     main.cpp \
-    kvasercanbackend.cpp
+    kvasercanbackend.cpp \
+    kvasercancache.cpp \
+    kvasercancapture.cpp \
+    kvasercanfilter.cpp \
+    kvasercanperiodic.cpp \
+    kvasercanprofiler.cpp \
+    kvasercanreplay.cpp \
+    kvasercanresponder.cpp \
+    kvasercansupervisor.cpp \
+    kvasercantiming.cpp
 
 DISTFILES = plugin.json
@@ -0,0 +1,201 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCAN_CONSTANTS_P_H
+#define KVASERCAN_CONSTANTS_P_H
+
+#include <QtCore/qglobal.h>
+
+// CANLIB constants and structures, without the function pointers of
+// kvasercan_symbols_p.h, for the files that never call into the driver.
+
+enum class KvaserStatus {
+    OK = 0,
+    NoMessages = -2,
+    TransmitBufferOverflow = -13
+};
+
+enum class KvaserCanGetChannelDataItem {
+    Capabilities = 1,
+    CardChannelNumber = 6,
+    CardSerialNumber = 7,
+    CardUpcNumber = 11,
+    DeviceProductName  = 26,
+    // int32[4]: version, numerator, denominator and power of ten of the
+    // controller clock in MHz
+    ClockInfo = 46
+};
+
+enum class KvaserDriverMode {
+    Silent = 1,
+    Normal = 4
+};
+
+#define KVASER_CAPABILITY_VIRTUAL          0x10000
+#define KVASER_CAPABILITY_CANFD            0x80000
+#define KVASER_CAPABILITY_CANFD_NON_ISO   0x100000
+
+#define KVASER_BITRATE_10K  (-9)
+#define KVASER_BITRATE_50K  (-7)
+#define KVASER_BITRATE_62K  (-6)
+#define KVASER_BITRATE_83K  (-8)
+#define KVASER_BITRATE_100K (-5)
+#define KVASER_BITRATE_125K (-4)
+#define KVASER_BITRATE_250K (-3)
+#define KVASER_BITRATE_500K (-2)
+#define KVASER_BITRATE_1M   (-1)
+
+#define KVASER_DATA_BITRATE_500K_80P (-1000)
+#define KVASER_DATA_BITRATE_1M_80P (-1001)
+#define KVASER_DATA_BITRATE_2M_80P (-1002)
+#define KVASER_DATA_BITRATE_4M_80P (-1003)
+#define KVASER_DATA_BITRATE_8M_60P (-1004)
+#define KVASER_DATA_BITRATE_8M_80P (-1005)
+#define KVASER_DATA_BITRATE_8M_70P (-1006)
+
+#define KVASER_NOTIFY_RX        0x01
+#define KVASER_NOTIFY_TX        0x02
+#define KVASER_NOTIFY_ERROR     0x04
+#define KVASER_NOTIFY_STATUS    0x08
+#define KVASER_NOTIFY_BUSONOFF  0x20
+#define KVASER_NOTIFY_REMOVED   0x40
+
+#define KVASER_STATUS_ERROR_PASSIVE    0x1
+#define KVASER_STATUS_BUSOFF           0x2
+#define KVASER_STATUS_ERROR_WARNING    0x4
+#define KVASER_STATUS_ERROR_ACTIVE     0x8
+#define KVASER_STATUS_TX_PENDING      0x10
+#define KVASER_STATUS_RX_PENDING      0x20
+#define KVASER_STATUS_TX_ERROR        0x80
+#define KVASER_STATUS_RX_ERROR       0x100
+#define KVASER_STATUS_HW_OVERRUN     0x200
+#define KVASER_STATUS_SW_OVERRUN     0x400
+
+#define KVASER_MESSAGE_REMOTE_REQUEST           0x000001
+#define KVASER_MESSAGE_STANDARD_FRAME_FORMAT    0x000002
+#define KVASER_MESSAGE_EXTENDED_FRAME_FORMAT    0x000004
+#define KVASER_MESSAGE_ERROR_FRAME              0x000020
+#define KVASER_MESSAGE_TRANSMIT_ACKNOWLEDGE     0x000040
+#define KVASER_MESSAGE_ERROR_HW_OVERRUN         0x000200
+#define KVASER_MESSAGE_ERROR_SW_OVERRUN         0x000400
+#define KVASER_MESSAGE_ERROR_STUFF              0x000800
+#define KVASER_MESSAGE_ERROR_FORM               0x001000
+#define KVASER_MESSAGE_ERROR_CRC                0x002000
+#define KVASER_MESSAGE_ERROR_BIT0               0x004000
+#define KVASER_MESSAGE_ERROR_BIT1               0x008000
+#define KVASER_MESSAGE_CANFD                    0x010000
+#define KVASER_MESSAGE_BIT_RATE_SWITCH          0x020000
+#define KVASER_MESSAGE_ERROR_STATE_INDICATOR    0x040000
+
+#define KVASER_OPEN_ACCEPT_VIRTUAL       0x20
+#define KVASER_OPEN_REQUIRE_INIT_ACCESS  0x80
+#define KVASER_OPEN_NO_INIT_ACCESS      0x100
+#define KVASER_OPEN_CANFD               0x400
+
+#define KVASER_IOCTL_SET_TIMER_SCALE 6
+#define KVASER_IOCTL_FLUSH_RX_BUFFER 10
+#define KVASER_IOCTL_RECEIVE_OWN_KEY 7
+#define KVASER_IOCTL_SET_LOOPBACK 32
+
+#define KVASER_FILTER_STANDARD_FRAME_FORMAT 0
+#define KVASER_FILTER_EXTENDED_FRAME_FORMAT 1
+
+#define KVASER_OBJBUF_AUTO_RESPONSE 0x01
+#define KVASER_OBJBUF_PERIODIC_TX 0x02
+#define KVASER_OBJBUF_AUTO_RESPONSE_RTR_ONLY 0x01
+
+typedef int KvaserHandle;
+
+// Bit timing in time quanta, tq is the number of quanta per bit including
+// the sync segment.
+struct KvaserBusParamsTq {
+    int tq;
+    int phase1;
+    int phase2;
+    int sjw;
+    int prop;
+    int prescaler;
+};
+
+// Bus statistics counted by the device since bus on, busLoad is in
+// units of 0.01 percent.
+struct KvaserBusStatistics {
+    unsigned long stdData;
+    unsigned long stdRemote;
+    unsigned long extData;
+    unsigned long extRemote;
+    unsigned long errFrame;
+    unsigned long busLoad;
+    unsigned long overruns;
+};
+
+#if !defined(Q_OS_WIN32)
+// The Linux CANLIB passes a single notification structure to the callback
+// instead of the handle, context and event flags used on Windows.
+#define KVASER_EVENT_RX        32000
+#define KVASER_EVENT_TX        32001
+#define KVASER_EVENT_ERROR     32002
+#define KVASER_EVENT_STATUS    32003
+#define KVASER_EVENT_BUSONOFF  32005
+#define KVASER_EVENT_REMOVED   32006
+
+struct KvaserNotifyData {
+    void *tag;
+    int eventType;
+    union {
+        struct {
+            unsigned long time;
+        } busErr;
+        struct {
+            long id;
+            unsigned long time;
+        } rx;
+        struct {
+            long id;
+            unsigned long time;
+        } tx;
+        struct {
+            unsigned char busStatus;
+            unsigned char txErrorCounter;
+            unsigned char rxErrorCounter;
+            unsigned long time;
+        } status;
+    } info;
+};
+
+#endif
+
+#endif // KVASERCAN_CONSTANTS_P_H
@@ -37,21 +37,28 @@
 #ifndef KVASERCAN_SYMBOLS_P_H
 #define KVASERCAN_SYMBOLS_P_H
 
+#include "kvasercan_constants_p.h"
+
 #include <QtCore/qlibrary.h>
 #include <QtCore/qsettings.h>
 
-#ifdef Q_OS_WIN32
+#if defined(Q_OS_WIN32)
 #  include <windows.h>
+#  define KVASER_CALLCONV WINAPI
+#  define KVASER_IMPORT __declspec(dllimport)
+#elif defined(Q_OS_LINUX)
+#  define KVASER_CALLCONV
+#  define KVASER_IMPORT
 #else
 #  error "Unsupported platform"
 #endif
 
 #ifdef LINK_LIBKVASERCAN
 #define GENERATE_SYMBOL_VARIABLE(returnType, symbolName, ...) \
-    extern "C" { extern returnType __declspec(dllimport) symbolName(__VA_ARGS__); }
+    extern "C" { extern returnType KVASER_IMPORT symbolName(__VA_ARGS__); }
 #else
 #define GENERATE_SYMBOL_VARIABLE(returnType, symbolName, ...) \
-    typedef returnType (WINAPI *fp_##symbolName)(__VA_ARGS__); \
+    typedef returnType (KVASER_CALLCONV *fp_##symbolName)(__VA_ARGS__); \
     static fp_##symbolName symbolName = nullptr;
 
 #define RESOLVE_SYMBOL(symbolName) \
@@ -62,84 +69,11 @@
     }
 #endif
 
-enum class KvaserStatus {
-    OK = 0,
-    NoMessages = -2
-};
-
-enum class KvaserCanGetChannelDataItem {
-    Capabilities = 1,
-    CardChannelNumber = 6,
-    CardSerialNumber = 7,
-    CardUpcNumber = 11,
-    DeviceProductName  = 26
-};
-
-enum class KvaserDriverMode {
-    Silent = 1,
-    Normal = 4
-};
-
-#define KVASER_CAPABILITY_VIRTUAL          0x10000
-#define KVASER_CAPABILITY_CANFD            0x80000
-#define KVASER_CAPABILITY_CANFD_NON_ISO   0x100000
-
-#define KVASER_BITRATE_10K  (-9)
-#define KVASER_BITRATE_50K  (-7)
-#define KVASER_BITRATE_62K  (-6)
-#define KVASER_BITRATE_83K  (-8)
-#define KVASER_BITRATE_100K (-5)
-#define KVASER_BITRATE_125K (-4)
-#define KVASER_BITRATE_250K (-3)
-#define KVASER_BITRATE_500K (-2)
-#define KVASER_BITRATE_1M   (-1)
-
-#define KVASER_DATA_BITRATE_500K_80P (-1000)
-#define KVASER_DATA_BITRATE_1M_80P (-1001)
-#define KVASER_DATA_BITRATE_2M_80P (-1002)
-#define KVASER_DATA_BITRATE_4M_80P (-1003)
-#define KVASER_DATA_BITRATE_8M_60P (-1004)
-#define KVASER_DATA_BITRATE_8M_80P (-1005)
-#define KVASER_DATA_BITRATE_8M_70P (-1006)
-
-#define KVASER_NOTIFY_RX        0x01
-#define KVASER_NOTIFY_TX        0x02
-#define KVASER_NOTIFY_ERROR     0x04
-#define KVASER_NOTIFY_STATUS    0x08
-#define KVASER_NOTIFY_BUSONOFF  0x20
-#define KVASER_NOTIFY_REMOVED   0x40
-
-#define KVASER_STATUS_ERROR_PASSIVE    0x1
-#define KVASER_STATUS_BUSOFF           0x2
-#define KVASER_STATUS_ERROR_WARNING    0x4
-#define KVASER_STATUS_ERROR_ACTIVE     0x8
-#define KVASER_STATUS_TX_PENDING      0x10
-#define KVASER_STATUS_RX_PENDING      0x20
-#define KVASER_STATUS_TX_ERROR        0x80
-#define KVASER_STATUS_RX_ERROR       0x100
-#define KVASER_STATUS_HW_OVERRUN     0x200
-#define KVASER_STATUS_SW_OVERRUN     0x400
-
-#define KVASER_MESSAGE_REMOTE_REQUEST           0x000001
-#define KVASER_MESSAGE_STANDARD_FRAME_FORMAT    0x000002
-#define KVASER_MESSAGE_EXTENDED_FRAME_FORMAT    0x000004
-#define KVASER_MESSAGE_ERROR_FRAME              0x000020
-#define KVASER_MESSAGE_CANFD                    0x010000
-#define KVASER_MESSAGE_BIT_RATE_SWITCH          0x020000
-
-#define KVASER_OPEN_ACCEPT_VIRTUAL       0x20
-#define KVASER_OPEN_REQUIRE_INIT_ACCESS  0x80
-#define KVASER_OPEN_NO_INIT_ACCESS      0x100
-#define KVASER_OPEN_CANFD               0x400
-
-#define KVASER_IOCTL_RECEIVE_OWN_KEY 7
-#define KVASER_IOCTL_SET_LOOPBACK 32
-
-#define KVASER_FILTER_STANDARD_FRAME_FORMAT 0
-#define KVASER_FILTER_EXTENDED_FRAME_FORMAT 1
-
-typedef int KvaserHandle;
-typedef void (WINAPI *KvaserCallback) (KvaserHandle, void *, quint32);
+#if defined(Q_OS_WIN32)
+typedef void (KVASER_CALLCONV *KvaserCallback) (KvaserHandle, void *, quint32);
+#else
+typedef void (KVASER_CALLCONV *KvaserCallback) (KvaserNotifyData *);
+#endif
 
 GENERATE_SYMBOL_VARIABLE(void, canInitializeLibrary, void)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canGetNumberOfChannels, int *)
@@ -147,25 +81,44 @@ GENERATE_SYMBOL_VARIABLE(KvaserStatus, canGetChannelData, int, KvaserCanGetChann
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canIoCtl, KvaserHandle, quint32, void *, quint32)
 GENERATE_SYMBOL_VARIABLE(KvaserHandle, canOpenChannel, int, int)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canClose, KvaserHandle)
-GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParams, KvaserHandle, qint32, quint32, quint32, quint32, quint32, quint32)
-GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParamsFd, KvaserHandle, qint32, quint32, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParams, KvaserHandle, long, quint32, quint32, quint32, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParamsFd, KvaserHandle, long, quint32, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParamsTq, KvaserHandle, KvaserBusParamsTq)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusParamsFdTq, KvaserHandle, KvaserBusParamsTq, KvaserBusParamsTq)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetBusOutputControl, KvaserHandle, quint32)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canBusOn, KvaserHandle)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canBusOff, KvaserHandle)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, kvSetNotifyCallback, KvaserHandle, KvaserCallback, void *, quint32)
-GENERATE_SYMBOL_VARIABLE(KvaserStatus, canReadStatus, KvaserHandle, quint32 * const)
-GENERATE_SYMBOL_VARIABLE(KvaserStatus, canRead, KvaserHandle, quint32 *, void *, quint32 *, quint32 *, quint32 *)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canReadStatus, KvaserHandle, unsigned long * const)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canReadErrorCounters, KvaserHandle, quint32 *, quint32 *, quint32 *)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canRead, KvaserHandle, long *, void *, quint32 *, quint32 *, unsigned long *)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canGetErrorText, KvaserStatus, char *, size_t)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canResetBus, KvaserHandle)
-GENERATE_SYMBOL_VARIABLE(KvaserStatus, canWrite, KvaserHandle, quint32, const void *, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canWrite, KvaserHandle, long, const void *, quint32, quint32)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canSetAcceptanceFilter, KvaserHandle, quint32, quint32, int)
 GENERATE_SYMBOL_VARIABLE(KvaserStatus, canEnumHardwareEx, int *)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, kvReadTimer64, KvaserHandle, qint64 *)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canRequestBusStatistics, KvaserHandle)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canGetBusStatistics, KvaserHandle, KvaserBusStatistics *, size_t)
+// Returns the index of the allocated buffer or a negative KvaserStatus
+GENERATE_SYMBOL_VARIABLE(int, canObjBufAllocate, KvaserHandle, int)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufFree, KvaserHandle, int)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufWrite, KvaserHandle, int, int, const void *, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufSetPeriod, KvaserHandle, int, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufEnable, KvaserHandle, int)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufDisable, KvaserHandle, int)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufSetFilter, KvaserHandle, int, quint32, quint32)
+GENERATE_SYMBOL_VARIABLE(KvaserStatus, canObjBufSetFlags, KvaserHandle, int, quint32)
 
 #ifndef LINK_LIBKVASERCAN
 inline bool resolveKvaserCanSymbols(QLibrary *kvasercanLibrary, QString *errorReason)
 {
     if (!kvasercanLibrary->isLoaded()) {
+#ifdef Q_OS_WIN32
         kvasercanLibrary->setFileName(QStringLiteral("canlib32"));
+#else
+        kvasercanLibrary->setFileNameAndVersion(QStringLiteral("canlib"), 1);
+#endif
 #ifdef Q_OS_WIN32
          if (!kvasercanLibrary->load()) {
             kvasercanLibrary->unload();
@@ -200,6 +153,7 @@ inline bool resolveKvaserCanSymbols(QLibrary *kvasercanLibrary, QString *errorRe
     RESOLVE_SYMBOL(canBusOff)
     RESOLVE_SYMBOL(kvSetNotifyCallback)
     RESOLVE_SYMBOL(canReadStatus)
+    RESOLVE_SYMBOL(canReadErrorCounters)
     RESOLVE_SYMBOL(canRead)
     RESOLVE_SYMBOL(canGetErrorText)
     RESOLVE_SYMBOL(canResetBus)
@@ -209,6 +163,19 @@ inline bool resolveKvaserCanSymbols(QLibrary *kvasercanLibrary, QString *errorRe
     // These function only exists in newer versions of CANLIB
     canEnumHardwareEx = reinterpret_cast<fp_canEnumHardwareEx>(kvasercanLibrary->resolve("canEnumHardwareEx"));
     canSetBusParamsFd = reinterpret_cast<fp_canSetBusParamsFd>(kvasercanLibrary->resolve("canSetBusParamsFd"));
+    canSetBusParamsTq = reinterpret_cast<fp_canSetBusParamsTq>(kvasercanLibrary->resolve("canSetBusParamsTq"));
+    canSetBusParamsFdTq = reinterpret_cast<fp_canSetBusParamsFdTq>(kvasercanLibrary->resolve("canSetBusParamsFdTq"));
+    kvReadTimer64 = reinterpret_cast<fp_kvReadTimer64>(kvasercanLibrary->resolve("kvReadTimer64"));
+    canRequestBusStatistics = reinterpret_cast<fp_canRequestBusStatistics>(kvasercanLibrary->resolve("canRequestBusStatistics"));
+    canGetBusStatistics = reinterpret_cast<fp_canGetBusStatistics>(kvasercanLibrary->resolve("canGetBusStatistics"));
+    canObjBufAllocate = reinterpret_cast<fp_canObjBufAllocate>(kvasercanLibrary->resolve("canObjBufAllocate"));
+    canObjBufFree = reinterpret_cast<fp_canObjBufFree>(kvasercanLibrary->resolve("canObjBufFree"));
+    canObjBufWrite = reinterpret_cast<fp_canObjBufWrite>(kvasercanLibrary->resolve("canObjBufWrite"));
+    canObjBufSetPeriod = reinterpret_cast<fp_canObjBufSetPeriod>(kvasercanLibrary->resolve("canObjBufSetPeriod"));
+    canObjBufEnable = reinterpret_cast<fp_canObjBufEnable>(kvasercanLibrary->resolve("canObjBufEnable"));
+    canObjBufDisable = reinterpret_cast<fp_canObjBufDisable>(kvasercanLibrary->resolve("canObjBufDisable"));
+    canObjBufSetFilter = reinterpret_cast<fp_canObjBufSetFilter>(kvasercanLibrary->resolve("canObjBufSetFilter"));
+    canObjBufSetFlags = reinterpret_cast<fp_canObjBufSetFlags>(kvasercanLibrary->resolve("canObjBufSetFlags"));
 
     return true;
 }
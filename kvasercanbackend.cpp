@@ -41,11 +41,20 @@
 #include <QtSerialBus/qcanbusdevice.h>
 
 #include <QtCore/qcoreevent.h>
+#include <QtCore/qeventloop.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qloggingcategory.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qstringlist.h>
 #include <QtCore/qtimer.h>
 #include <QtCore/qlibrary.h>
 
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
 
 QT_BEGIN_NAMESPACE
 
@@ -55,25 +64,91 @@ Q_DECLARE_LOGGING_CATEGORY(QT_CANBUS_PLUGINS_KVASERCAN)
 Q_GLOBAL_STATIC(QLibrary, kvasercanLibrary)
 #endif
 
+// Error frame payload layout, compatible with SocketCAN
+enum ErrorFrameByte {
+    ErrorControllerStatusByte = 1,
+    ErrorProtocolTypeByte = 2,
+    ErrorProtocolLocationByte = 3,
+    ErrorOverrunByte = 5,
+    ErrorTxCounterByte = 6,
+    ErrorRxCounterByte = 7
+};
+
+#define ERROR_CONTROLLER_RX_OVERFLOW  0x01
+#define ERROR_CONTROLLER_RX_WARNING   0x04
+#define ERROR_CONTROLLER_TX_WARNING   0x08
+#define ERROR_CONTROLLER_RX_PASSIVE   0x10
+#define ERROR_CONTROLLER_TX_PASSIVE   0x20
+
+#define ERROR_PROTOCOL_BIT    0x01
+#define ERROR_PROTOCOL_FORM   0x02
+#define ERROR_PROTOCOL_STUFF  0x04
+#define ERROR_PROTOCOL_BIT0   0x08
+#define ERROR_PROTOCOL_BIT1   0x10
+
+#define ERROR_LOCATION_CRC_SEQUENCE 0x08
+
+#define ERROR_OVERRUN_HARDWARE 0x01
+#define ERROR_OVERRUN_SOFTWARE 0x02
+
+// Number of messages the receive thread can buffer for the Qt thread
+static const quint32 receiveRingCapacity = 8192;
+
+// Bounds the latency of a receive batch with a size but no timeout, in
+// microseconds, so a quiet bus does not keep its last frames forever
+static const quint32 defaultReceiveBatchTimeout = 10000;
+
 // WARNING: This function is called from a high priority thread within CANLIB.
 //          Sending a message to Qt on every event WILL hang the Qt event loop
 //          under high bus loads, since events will be coming in faster than
 //          they can be processed.
-static void WINAPI callbackHandler(KvaserHandle, void *internalPointer, quint32 eventFlags)
+static void handleNotification(KvaserCanBackend *backend, quint32 eventFlags)
 {
-    auto backend = static_cast<KvaserCanBackend*>(internalPointer);
     if (eventFlags & KVASER_NOTIFY_RX)
-        backend->setMessagesAvailable();
+        backend->setMessagesPending();
+    if (eventFlags & KVASER_NOTIFY_TX)
+        backend->setTransmitSpaceAvailable();
     if (eventFlags & KVASER_NOTIFY_ERROR)
-        backend->setMessagesAvailable();
-    if (eventFlags & KVASER_NOTIFY_STATUS)
-        QMetaObject::invokeMethod(backend, &KvaserCanBackend::onStatusChanged, Qt::QueuedConnection);
-    if (eventFlags & KVASER_NOTIFY_BUSONOFF)
-        QMetaObject::invokeMethod(backend, &KvaserCanBackend::onBusOnOff, Qt::QueuedConnection);
+        backend->setMessagesPending();
+    if (eventFlags & (KVASER_NOTIFY_STATUS | KVASER_NOTIFY_BUSONOFF))
+        backend->setStatusChanged();
     if (eventFlags & KVASER_NOTIFY_REMOVED)
         QMetaObject::invokeMethod(backend, &KvaserCanBackend::onDeviceRemoved, Qt::QueuedConnection);
 }
 
+#if defined(Q_OS_WIN32)
+static void KVASER_CALLCONV callbackHandler(KvaserHandle, void *internalPointer, quint32 eventFlags)
+{
+    handleNotification(static_cast<KvaserCanBackend*>(internalPointer), eventFlags);
+}
+#else
+static quint32 notifyFlagsFromEvent(int eventType)
+{
+    switch (eventType) {
+    case KVASER_EVENT_RX:
+        return KVASER_NOTIFY_RX;
+    case KVASER_EVENT_TX:
+        return KVASER_NOTIFY_TX;
+    case KVASER_EVENT_ERROR:
+        return KVASER_NOTIFY_ERROR;
+    case KVASER_EVENT_STATUS:
+        return KVASER_NOTIFY_STATUS;
+    case KVASER_EVENT_BUSONOFF:
+        return KVASER_NOTIFY_BUSONOFF;
+    case KVASER_EVENT_REMOVED:
+        return KVASER_NOTIFY_REMOVED;
+    default:
+        return 0;
+    }
+}
+
+static void KVASER_CALLCONV callbackHandler(KvaserNotifyData *notifyData)
+{
+    handleNotification(static_cast<KvaserCanBackend*>(notifyData->tag),
+                       notifyFlagsFromEvent(notifyData->eventType));
+}
+#endif
+
 static QString systemErrorString(KvaserStatus errorCode)
 {
     char buffer[256];
@@ -83,16 +158,8 @@ static QString systemErrorString(KvaserStatus errorCode)
     return KvaserCanBackend::tr("Unable to retrieve an error string");
 }
 
-static bool getUniqueChannelId(int channel, QString *uniqueId)
+static bool getUniqueChannelId(int channel, quint64 serial, quint32 channelOnCard, QString *uniqueId)
 {
-    quint64 serial = 0;
-    if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardSerialNumber, &serial, sizeof(serial)) != KvaserStatus::OK)
-        return false;
-
-    quint32 channelOnCard = 0;
-    if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardChannelNumber, &channelOnCard, sizeof(channelOnCard)) != KvaserStatus::OK)
-        return false;
-
     quint8 deviceEan[8];
     if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardUpcNumber, deviceEan, sizeof(deviceEan)) != KvaserStatus::OK)
         return false;
@@ -111,8 +178,145 @@ static bool getUniqueChannelId(int channel, QString *uniqueId)
     return true;
 }
 
+struct KvaserChannelInfo
+{
+    int index = -1;
+    QString uniqueId;
+    QString productName;
+    quint64 serial = 0;
+    quint32 channelOnCard = 0;
+    quint32 capabilities = 0;
+    // Controller clock in Hz, 0 if the driver cannot tell
+    quint32 clockFrequency = 0;
+};
+
+// Process-wide cache of the CANLIB channels, shared by interfaces() and
+// open(). Channel indexes only change when canEnumHardwareEx is called, so
+// the cache is rebuilt whenever that happens and dropped when a device is
+// removed.
+class KvaserChannelCache
+{
+public:
+    // Re-enumerates the hardware and rebuilds the cache
+    KvaserStatus refresh()
+    {
+        int channelCount = 0;
+        const KvaserStatus result = canEnumHardwareEx(&channelCount);
+
+        QMutexLocker locker(&m_mutex);
+        m_channels.clear();
+        m_channelIndexes.clear();
+        m_valid = false;
+        if (result != KvaserStatus::OK)
+            return result;
+
+        for (int channel = 0; channel < channelCount; ++channel) {
+            KvaserChannelInfo info;
+            info.index = channel;
+
+            char name[256];
+            if (canGetChannelData(channel, KvaserCanGetChannelDataItem::DeviceProductName, &name, sizeof(name)) != KvaserStatus::OK)
+                continue;
+            info.productName = QLatin1String(name);
+
+            if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardSerialNumber, &info.serial, sizeof(info.serial)) != KvaserStatus::OK)
+                continue;
+
+            if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardChannelNumber, &info.channelOnCard, sizeof(info.channelOnCard)) != KvaserStatus::OK)
+                continue;
+
+            if (canGetChannelData(channel, KvaserCanGetChannelDataItem::Capabilities, &info.capabilities, sizeof(info.capabilities)) != KvaserStatus::OK)
+                continue;
+
+            if (!getUniqueChannelId(channel, info.serial, info.channelOnCard, &info.uniqueId))
+                continue;
+
+            // Frequency in MHz is numerator / denominator * 10^power
+            qint32 clockInfo[4] = {};
+            if (canGetChannelData(channel, KvaserCanGetChannelDataItem::ClockInfo, clockInfo, sizeof(clockInfo)) == KvaserStatus::OK
+                    && clockInfo[1] > 0 && clockInfo[2] > 0) {
+                const double megaHertz = double(clockInfo[1]) / double(clockInfo[2]) * std::pow(10.0, clockInfo[3]);
+                if (megaHertz > 0.0 && megaHertz < 4000.0)
+                    info.clockFrequency = quint32(qRound64(megaHertz * 1e6));
+            }
+
+            m_channelIndexes.insert(info.uniqueId, m_channels.size());
+            m_channels.append(info);
+        }
+        m_valid = true;
+        return KvaserStatus::OK;
+    }
+
+    void invalidate()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_valid = false;
+    }
+
+    QList<KvaserChannelInfo> channels() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_channels;
+    }
+
+    // Looks the channel up without any driver call while the cache is valid
+    bool find(const QString &uniqueId, KvaserChannelInfo *info)
+    {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            {
+                QMutexLocker locker(&m_mutex);
+                if (m_valid) {
+                    const int position = m_channelIndexes.value(uniqueId, -1);
+                    if (position >= 0) {
+                        *info = m_channels.at(position);
+                        return true;
+                    }
+                    if (attempt > 0)
+                        return false;
+                }
+            }
+            // Unknown or stale, the channel may have been plugged in since
+            if (refresh() != KvaserStatus::OK)
+                return false;
+        }
+        return false;
+    }
+
+private:
+    mutable QMutex m_mutex;
+    bool m_valid = false;
+    QList<KvaserChannelInfo> m_channels;
+    QHash<QString, int> m_channelIndexes;
+};
+
+Q_GLOBAL_STATIC(KvaserChannelCache, channelCache)
+
 KvaserCanBackend::KvaserCanBackend(const QString &name, QObject *parent) : QCanBusDevice(parent)
 {
+    // Signal arguments of queued connections
+    qRegisterMetaType<KvaserCanBackend::BusStatistics>();
+    qRegisterMetaType<KvaserCanBackend::BusState>();
+    qRegisterMetaType<QList<KvaserMessageTimeout>>();
+
+    m_receiveBatchTimer = new QTimer(this);
+    m_receiveBatchTimer->setSingleShot(true);
+    m_receiveBatchTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_receiveBatchTimer, &QTimer::timeout, this, &KvaserCanBackend::flushReceivedFrames);
+
+    // Reading frames does not notify the backend, so a stopped drain polls
+    // for room in the receive queue.
+    m_receivePollTimer = new QTimer(this);
+    m_receivePollTimer->setSingleShot(true);
+    m_receivePollTimer->setInterval(10);
+    connect(m_receivePollTimer, &QTimer::timeout, this, &KvaserCanBackend::onMessagesAvailable);
+
+    m_busStatisticsTimer = new QTimer(this);
+    connect(m_busStatisticsTimer, &QTimer::timeout, this, &KvaserCanBackend::sampleBusStatistics);
+
+    m_supervisionTimer = new QTimer(this);
+    m_supervisionTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_supervisionTimer, &QTimer::timeout, this, &KvaserCanBackend::superviseCycleTimes);
+
     setupChannel(name);
     setupDefaultConfigurations();
 }
@@ -120,65 +324,186 @@ KvaserCanBackend::KvaserCanBackend(const QString &name, QObject *parent) : QCanB
 KvaserCanBackend::~KvaserCanBackend()
 {
     KvaserCanBackend::close();
+    delete m_replayThread;
 }
 
-bool KvaserCanBackend::open()
+// Opens the channel, with init access if no other handle has it. Returns
+// the handle, or a negative value after setting the error.
+KvaserHandle KvaserCanBackend::openChannel(const QString &interfaceName, int flags, quint64 *serial)
+{
+    KvaserChannelInfo channelInfo;
+    if (Q_UNLIKELY(!channelCache()->find(interfaceName, &channelInfo))) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Interface not available: %ls.", qUtf16Printable(interfaceName));
+        setError(tr("Interface not available"), CanBusError::ConnectionError);
+        return -1;
+    }
+    const int channelIndex = channelInfo.index;
+    if (serial)
+        *serial = channelInfo.serial;
+    // The bit timing is calculated for the first channel opened
+    if (m_clockFrequency == 0)
+        m_clockFrequency = channelInfo.clockFrequency;
+
+    KvaserHandle handle = canOpenChannel(channelIndex, flags | KVASER_OPEN_REQUIRE_INIT_ACCESS);
+
+    if (handle < 0) {
+        m_initAccess = false;
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Could NOT get init access, won't be able to set bitrate configuratin etc.");
+        handle = canOpenChannel(channelIndex, flags | KVASER_OPEN_NO_INIT_ACCESS);
+    }
+
+    if (Q_UNLIKELY(handle < 0)) {
+        const QString errorString = systemErrorString((KvaserStatus)handle);
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to open channel: %ls.", qUtf16Printable(errorString));
+        setError(errorString, CanBusError::ConnectionError);
+    } else if (m_channelIndex < 0) {
+        m_channelIndex = channelIndex;
+    }
+    return handle;
+}
+
+// CANLIB handles must not be used by two threads at the same time, so each
+// backend thread calling the driver gets a handle of its own on the first
+// channel. It has no init access, the timer scale of the backend handle
+// and is bus on. Returns a negative value after setting the error.
+KvaserHandle KvaserCanBackend::openThreadHandle(bool transmitEcho)
 {
-    int channelCount = 0;
-    KvaserStatus result = canEnumHardwareEx(&channelCount);
+    const KvaserHandle handle = canOpenChannel(m_channelIndex, m_openFlags | KVASER_OPEN_NO_INIT_ACCESS);
+    if (Q_UNLIKELY(handle < 0)) {
+        const QString errorString = systemErrorString((KvaserStatus)handle);
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to open a thread handle: %ls.", qUtf16Printable(errorString));
+        setError(errorString, CanBusError::ConnectionError);
+        return handle;
+    }
+
+    setTimerScale(handle);
+    char echo = transmitEcho ? 1 : 0;
+    canIoCtl(handle, KVASER_IOCTL_SET_LOOPBACK, &echo, sizeof(echo));
+    const KvaserStatus result = canBusOn(handle);
     if (Q_UNLIKELY(result != KvaserStatus::OK)) {
         const QString errorString = systemErrorString(result);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to get devices: %ls.", qUtf16Printable(errorString));
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to go bus on with a thread handle: %ls.",
+                  qUtf16Printable(errorString));
         setError(errorString, CanBusError::ConnectionError);
-        return false;
+        canClose(handle);
+        return -1;
     }
+    return handle;
+}
 
-    int channelIndex = -1;
-    for (int channel = 0; channel < channelCount; ++channel) {
-        QString uniqueId;
-        if (Q_LIKELY(getUniqueChannelId(channel, &uniqueId)))
-        {
-            if (uniqueId == m_interfaceName) {
-                channelIndex = channel;
-                break;
-            }
+void KvaserCanBackend::closeThreadHandle(KvaserHandle handle)
+{
+    if (handle < 0)
+        return;
+    canBusOff(handle);
+    canClose(handle);
+}
+
+// Channels of one device share its timer. Timestamps of channels on
+// different devices only compare on the host clock, so such devices are
+// refused if their timers cannot be synchronized to it.
+bool KvaserCanBackend::openMembers(int flags)
+{
+    m_members.resize(size_t(m_channelNames.size()));
+    bool sameDevice = true;
+    quint64 firstSerial = 0;
+    for (size_t member = 0; member < m_members.size(); ++member) {
+        quint64 serial = 0;
+        const KvaserHandle handle = openChannel(m_channelNames.at(int(member)), flags, &serial);
+        if (handle < 0) {
+            close();
+            return false;
+        }
+        m_members[member].handle = handle;
+        if (member == 0) {
+            m_kvaserHandle = handle;
+            firstSerial = serial;
+        } else if (serial != firstSerial) {
+            sameDevice = false;
         }
     }
 
-    if (Q_UNLIKELY(channelIndex < 0)) {
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Interface not available: %ls.", qUtf16Printable(m_interfaceName));
-        setError(tr("Interface not available"), CanBusError::ConnectionError);
-        return false;
+    for (KvaserMemberChannel &member : m_members) {
+        const bool hostAligned = m_hostTimestamps || !sameDevice;
+        member.timestamps.reset(member.handle, setTimerScale(member.handle), hostAligned);
+        member.timestamps.synchronize(true);
+        // A slow round trip gives no sample, retry a few times
+        for (int attempt = 0; hostAligned && attempt < 3 && !member.timestamps.hostSynchronized(); ++attempt)
+            member.timestamps.synchronize(true);
+        if (!sameDevice && !member.timestamps.hostSynchronized()) {
+            setError(tr("Channels of different devices cannot be aggregated without synchronized "
+                        "host timestamps"), ConnectionError);
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+QVarLengthArray<KvaserHandle, 8> KvaserCanBackend::channelHandles() const
+{
+    QVarLengthArray<KvaserHandle, 8> handles;
+    if (m_members.empty()) {
+        handles.append(m_kvaserHandle);
+        return handles;
     }
+    for (const KvaserMemberChannel &member : m_members) {
+        if (member.handle >= 0)
+            handles.append(member.handle);
+    }
+    return handles;
+}
 
+void KvaserCanBackend::synchronizeTimestamps()
+{
+    m_timestamps.synchronize();
+    for (KvaserMemberChannel &member : m_members)
+        member.timestamps.synchronize();
+}
+
+bool KvaserCanBackend::open()
+{
     int flags = KVASER_OPEN_ACCEPT_VIRTUAL;
     if (m_canFd)
         flags |= KVASER_OPEN_CANFD;
+    m_channelIsCanFd = m_canFd;
+    m_openFlags = flags;
+    m_channelIndex = -1;
 
     m_initAccess = true;
-    m_kvaserHandle = canOpenChannel(channelIndex, flags | KVASER_OPEN_REQUIRE_INIT_ACCESS);
-
-    if (m_kvaserHandle < 0) {
-        m_initAccess = false;
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Could NOT get init access, won't be able to set bitrate configuratin etc.");
-        m_kvaserHandle = canOpenChannel(channelIndex, flags | KVASER_OPEN_NO_INIT_ACCESS);
-    }
-
-    if (Q_UNLIKELY(m_kvaserHandle < 0)) {
-        const QString errorString = systemErrorString((KvaserStatus)m_kvaserHandle);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to open channel: %ls.", qUtf16Printable(errorString));
-        setError(errorString, CanBusError::ConnectionError);
-        return false;
+    m_clockFrequency = 0;
+    if (m_channelNames.size() > 1) {
+        if (!openMembers(flags))
+            return false;
+    } else {
+        m_kvaserHandle = openChannel(m_interfaceName, flags, nullptr);
+        if (m_kvaserHandle < 0)
+            return false;
     }
 
-    result = kvSetNotifyCallback(m_kvaserHandle, callbackHandler, this,
-                                 KVASER_NOTIFY_RX | KVASER_NOTIFY_BUSONOFF |
-                                 KVASER_NOTIFY_REMOVED | KVASER_NOTIFY_STATUS);
-    if (Q_UNLIKELY(result != KvaserStatus::OK)) {
-        const QString errorString = systemErrorString(result);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set notify callback: %ls.", qUtf16Printable(errorString));
-        setError(errorString, CanBusError::ConnectionError);
-        return false;
+    m_activeDeliveryMode = m_deliveryMode;
+    m_notifiedSequence = 0;
+    if (m_activeDeliveryMode == CachedDelivery || m_activeDeliveryMode == ConflatedDelivery)
+        m_latestValues.allocate(int(qMin(m_latestValueCapacity, quint32(INT_MAX / 2))));
+    else
+        m_latestValues.release();
+
+    m_timestamps.reset(m_kvaserHandle, setTimerScale(m_kvaserHandle), m_hostTimestamps);
+    m_timestamps.synchronize(true);
+
+    // Every channel notifies the same backend, the notifications of all of
+    // them coalesce into one drain.
+    for (KvaserHandle handle : channelHandles()) {
+        KvaserStatus result = kvSetNotifyCallback(handle, callbackHandler, this,
+                                     KVASER_NOTIFY_RX | KVASER_NOTIFY_TX | KVASER_NOTIFY_ERROR | KVASER_NOTIFY_BUSONOFF |
+                                     KVASER_NOTIFY_REMOVED | KVASER_NOTIFY_STATUS);
+        if (Q_UNLIKELY(result != KvaserStatus::OK)) {
+            const QString errorString = systemErrorString(result);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set notify callback: %ls.", qUtf16Printable(errorString));
+            setError(errorString, CanBusError::ConnectionError);
+            close();
+            return false;
+        }
     }
 
     const auto keys = configurationKeys();
@@ -201,16 +526,57 @@ bool KvaserCanBackend::open()
         return false;
     }
 
+    // Started once the configuration is applied, the reader handle of the
+    // thread takes ReceiveOwnKey when it is opened
+    if (m_useReceiveThread) {
+        // All channels of an aggregated device are drained in one pass
+        if (!m_members.empty()) {
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "The receive thread is not used by aggregated devices.");
+        } else if (!startReceiveThread()) {
+            close();
+            return false;
+        }
+    }
+    // Notifications only come on changes
+    onStatusChanged();
+
     setState(ConnectedState);
+    startBusStatistics();
+    startCycleSupervision();
+    startCapture();
 
     return true;
 }
 
 void KvaserCanBackend::close()
 {
-    if (m_kvaserHandle >= 0)
-        canClose(m_kvaserHandle);
+    if (m_kvaserHandle >= 0) {
+        const auto handles = channelHandles();
+        for (KvaserHandle handle : handles)
+            kvSetNotifyCallback(handle, nullptr, nullptr, 0);
+        stopBusStatistics();
+        m_supervisionTimer->stop();
+        m_receivePollTimer->stop();
+        stopReplay();
+        stopPeriodicFrames();
+        removeAutoResponses();
+        stopReceiveThread();
+        m_capture.close();
+        for (KvaserHandle handle : handles)
+            canClose(handle);
+    }
+    m_members.clear();
+    m_busState.store(0, std::memory_order_relaxed);
+    m_reportedBusStatus = CanBusStatus::Unknown;
+    if (m_hasHeldFrame) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Discarding a frame the driver had no room for.");
+        m_statistics.writeFailures.add(1);
+        m_hasHeldFrame = false;
+    }
+    m_transmitStalled.store(false, std::memory_order_relaxed);
+    flushReceivedFrames();
     m_kvaserHandle = -1;
+    m_channelIndex = -1;
     setState(UnconnectedState);
 }
 
@@ -241,8 +607,99 @@ bool KvaserCanBackend::writeFrame(const QCanBusFrame &frame)
         return false;
     }
 
-    const QByteArray payload = frame.payload();
+    enqueueOutgoingFrame(frame);
+    // While stalled, the next transmit notification resumes writing
+    if (!m_transmitStalled.load(std::memory_order_acquire))
+        setTransmitReady();
+
+    return true;
+}
+
+// Writes the queued frames until the driver transmit buffer is full. The
+// rest is written when KVASER_NOTIFY_TX reports that space was freed.
+// Same as QCanBusDevice::waitForFramesWritten(), but on framesToWrite() of
+// the backend, which includes the held frame
+bool KvaserCanBackend::waitForFramesWritten(int msecs)
+{
+    if (m_waitingForFramesWritten) {
+        setError(tr("waitForFramesWritten() must not be called recursively"), OperationError);
+        return false;
+    }
+    if (state() != ConnectedState) {
+        setError(tr("Cannot wait for frames written as device is not connected."), OperationError);
+        return false;
+    }
+    if (framesToWrite() == 0)
+        return false;
+
+    enum { Written = 0, Error, Timeout };
+    QEventLoop loop;
+    connect(this, &QCanBusDevice::framesWritten, &loop, [&loop]() { loop.exit(Written); });
+    connect(this, &QCanBusDevice::errorOccurred, &loop, [&loop]() { loop.exit(Error); });
+    if (msecs >= 0)
+        QTimer::singleShot(msecs, &loop, [&loop]() { loop.exit(Timeout); });
+
+    m_waitingForFramesWritten = true;
+    int result = Written;
+    while (framesToWrite() > 0) {
+        result = loop.exec(QEventLoop::ExcludeUserInputEvents);
+        if (result > Written)
+            break;
+    }
+    m_waitingForFramesWritten = false;
+
+    if (result == Timeout) {
+        setError(tr("Timeout (%1 ms) during wait for frames written.").arg(msecs), TimeoutError);
+        return false;
+    }
+    return result == Written;
+}
+
+void KvaserCanBackend::writePendingFrames()
+{
+    m_transmitReady.store(false, std::memory_order_release);
+
+    if (m_kvaserHandle < 0)
+        return;
+
+    qint64 written = 0;
+    for (;;) {
+        if (!m_hasHeldFrame) {
+            if (!hasOutgoingFrames())
+                break;
+            m_heldFrame = dequeueOutgoingFrame();
+            m_hasHeldFrame = true;
+        }
+
+        KvaserStatus result = writeToDriver(m_heldFrame);
+        if (result == KvaserStatus::TransmitBufferOverflow) {
+            m_statistics.transmitBufferFull.add(1);
+            // Raise the flag before trying once more, so that a transmit
+            // notification arriving in between is not lost.
+            m_transmitStalled.store(true, std::memory_order_seq_cst);
+            result = writeToDriver(m_heldFrame);
+            if (result == KvaserStatus::TransmitBufferOverflow)
+                break;
+            m_transmitStalled.store(false, std::memory_order_relaxed);
+        }
+
+        m_hasHeldFrame = false;
+        if (result != KvaserStatus::OK) {
+            m_statistics.writeFailures.add(1);
+            setError(systemErrorString(result), WriteError);
+            continue;
+        }
+        m_statistics.writtenFrames.add(1);
+        m_statistics.writtenBytes.add(quint64(m_heldFrame.payload().size()));
+        ++written;
+    }
+
+    if (written > 0)
+        emit framesWritten(written);
+}
 
+static quint32 messageFlags(const QCanBusFrame &frame)
+{
     quint32 flags = 0;
     if (frame.frameType() == QCanBusFrame::RemoteRequestFrame)
         flags |= KVASER_MESSAGE_REMOTE_REQUEST;
@@ -262,133 +719,464 @@ bool KvaserCanBackend::writeFrame(const QCanBusFrame &frame)
     if (frame.hasBitrateSwitch())
         flags |= KVASER_MESSAGE_BIT_RATE_SWITCH;
 
-    KvaserStatus result = canWrite(m_kvaserHandle, frame.frameId(), payload, payload.size(), flags);
+    return flags;
+}
 
-    if (result != KvaserStatus::OK) {
-        setError(systemErrorString(result), WriteError);
-        return false;
+KvaserStatus KvaserCanBackend::writeToDriver(const QCanBusFrame &frame)
+{
+    const QByteArray payload = frame.payload();
+    return canWrite(m_kvaserHandle, frame.frameId(), payload, payload.size(), messageFlags(frame));
+}
+
+int KvaserCanBackend::startPeriodicFrame(const QCanBusFrame &frame, quint32 periodMicroSeconds)
+{
+    if (m_kvaserHandle < 0) {
+        setError(tr("Cannot transmit periodically while not connected"), OperationError);
+        return 0;
+    }
+    if (Q_UNLIKELY(!frame.isValid() || (frame.frameType() != QCanBusFrame::DataFrame
+                                        && frame.frameType() != QCanBusFrame::RemoteRequestFrame))) {
+        setError(tr("Only valid data and remote request frames can be transmitted periodically"), WriteError);
+        return 0;
+    }
+    if (periodMicroSeconds == 0) {
+        setError(tr("Invalid period"), OperationError);
+        return 0;
     }
 
-    return true;
+    const QByteArray payload = frame.payload();
+    PeriodicFrame periodic;
+    periodic.frameId = frame.frameId();
+    periodic.flags = messageFlags(frame);
+    periodic.objectBuffer = startPeriodicBuffer(periodic.frameId, periodic.flags, payload.constData(),
+                                                quint32(payload.size()), periodMicroSeconds);
+    if (periodic.objectBuffer < 0) {
+        if (!m_periodicScheduler) {
+            // The scheduler thread writes through a handle of its own
+            m_periodicHandle = openThreadHandle(false);
+            if (m_periodicHandle < 0)
+                return 0;
+            // The CANLIB entry points are resolved in this file
+            const KvaserHandle handle = m_periodicHandle;
+            auto write = [handle](quint32 id, const char *data, quint32 length, quint32 flags) {
+                return canWrite(handle, long(id), data, length, flags);
+            };
+            m_periodicScheduler = new KvaserPeriodicScheduler(write);
+            m_periodicScheduler->setObjectName(QStringLiteral("KvaserCanPeriodic"));
+            m_periodicScheduler->start(QThread::TimeCriticalPriority);
+        }
+        periodic.message = m_periodicScheduler->addMessage(periodic.frameId, periodic.flags, periodMicroSeconds,
+                                                           payload.constData(), quint32(payload.size()));
+    }
+
+    const int periodicId = m_nextPeriodicId++;
+    m_periodicFrames.insert(periodicId, periodic);
+    return periodicId;
 }
 
-QString KvaserCanBackend::interpretErrorFrame(const QCanBusFrame &errorFrame)
+// Returns the index of the enabled object buffer, -1 if this CANLIB
+// version or the device cannot transmit the frame periodically
+int KvaserCanBackend::startPeriodicBuffer(quint32 frameId, quint32 flags, const char *payload, quint32 length,
+                                          quint32 periodMicroSeconds)
 {
-    if (errorFrame.frameType() != QCanBusFrame::ErrorFrame)
-        return QString();
-    // TODO: Implement this
-    return {};
+    if (!canObjBufAllocate || !canObjBufFree || !canObjBufWrite || !canObjBufSetPeriod
+            || !canObjBufEnable || !canObjBufDisable) {
+        return -1;
+    }
+
+    const int index = canObjBufAllocate(m_kvaserHandle, KVASER_OBJBUF_PERIODIC_TX);
+    if (index < 0)
+        return -1;
+    KvaserStatus result = canObjBufSetPeriod(m_kvaserHandle, index, periodMicroSeconds);
+    if (result == KvaserStatus::OK)
+        result = canObjBufWrite(m_kvaserHandle, index, int(frameId), payload, length, flags);
+    if (result == KvaserStatus::OK)
+        result = canObjBufEnable(m_kvaserHandle, index);
+    if (result != KvaserStatus::OK) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot use a periodic object buffer, scheduling in software: %ls.",
+                  qUtf16Printable(systemErrorString(result)));
+        canObjBufFree(m_kvaserHandle, index);
+        return -1;
+    }
+    return index;
 }
 
-bool KvaserCanBackend::canCreate(QString *errorReason)
+bool KvaserCanBackend::updatePeriodicPayload(int periodicId, const char *payload, int size)
 {
-#ifndef LINK_LIBKVASERCAN
-    static bool symbolsResolved = resolveKvaserCanSymbols(kvasercanLibrary(), errorReason);
-    if (Q_UNLIKELY(!symbolsResolved))
+    const auto it = m_periodicFrames.constFind(periodicId);
+    if (it == m_periodicFrames.constEnd())
+        return false;
+    const int maximumSize = (it->flags & KVASER_MESSAGE_CANFD) ? 64 : 8;
+    if (size < 0 || size > maximumSize) {
+        setError(tr("Invalid payload size"), WriteError);
+        return false;
+    }
+
+    if (it->objectBuffer < 0) {
+        it->message->setPayload(payload, quint32(size));
+        return true;
+    }
+    const KvaserStatus result = canObjBufWrite(m_kvaserHandle, it->objectBuffer, int(it->frameId), payload,
+                                               quint32(size), it->flags);
+    if (result != KvaserStatus::OK) {
+        setError(systemErrorString(result), WriteError);
         return false;
-    if (canEnumHardwareEx == nullptr) {
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Old version of CANLIB detected. Plugging in hardware after the program has started is not supported.");
-        canEnumHardwareEx = canGetNumberOfChannels;
     }
-#endif
-    canInitializeLibrary();
     return true;
 }
 
-QList<QCanBusDeviceInfo> KvaserCanBackend::interfaces()
+bool KvaserCanBackend::stopPeriodicFrame(int periodicId)
 {
-    int channelCount = 0;
-    if (canEnumHardwareEx(&channelCount) != KvaserStatus::OK) {
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot get number of channels");
-        return QList<QCanBusDeviceInfo>();
+    const auto it = m_periodicFrames.constFind(periodicId);
+    if (it == m_periodicFrames.constEnd())
+        return false;
+    if (it->objectBuffer >= 0) {
+        canObjBufDisable(m_kvaserHandle, it->objectBuffer);
+        canObjBufFree(m_kvaserHandle, it->objectBuffer);
+    } else {
+        m_periodicScheduler->removeMessage(it->message);
     }
+    m_periodicFrames.erase(it);
+    return true;
+}
 
-    int numActual = 0;
-    for (int channel = 0; channel < channelCount; ++channel) {
-        quint32 capabilities = 0;
-        if (canGetChannelData(channel, KvaserCanGetChannelDataItem::Capabilities, &capabilities, sizeof(capabilities)) != KvaserStatus::OK)
-            continue;
-        const bool isVirtual = capabilities & KVASER_CAPABILITY_VIRTUAL;
-
-        if (!isVirtual)
-            ++numActual;
+void KvaserCanBackend::stopPeriodicFrames()
+{
+    while (!m_periodicFrames.isEmpty())
+        stopPeriodicFrame(m_periodicFrames.constBegin().key());
+    if (m_periodicScheduler) {
+        m_periodicScheduler->stop();
+        delete m_periodicScheduler;
+        m_periodicScheduler = nullptr;
+        closeThreadHandle(m_periodicHandle);
+        m_periodicHandle = -1;
     }
+}
 
-    QList<QCanBusDeviceInfo> result;
-    for (int channel = 0; channel < channelCount; ++channel) {
-        char name[256];
-        if (canGetChannelData(channel, KvaserCanGetChannelDataItem::DeviceProductName, &name, sizeof(name)) != KvaserStatus::OK)
-            continue;
-
-        quint64 serial = 0;
-        if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardSerialNumber, &serial, sizeof(serial)) != KvaserStatus::OK)
-            continue;
-
-        quint32 channelOnCard = 0;
-        if (canGetChannelData(channel, KvaserCanGetChannelDataItem::CardChannelNumber, &channelOnCard, sizeof(channelOnCard)) != KvaserStatus::OK)
-            continue;
-
-        quint32 capabilities = 0;
-        if (canGetChannelData(channel, KvaserCanGetChannelDataItem::Capabilities, &capabilities, sizeof(capabilities)) != KvaserStatus::OK)
-            continue;
-
-        // Channel numbers change when devices are plugged in or removed, use
-        // unique name based on EAN and serial number instead of "can<n>", so that
-        // the device identifier is always the same.
-        QString uniqueId;
-        if (getUniqueChannelId(channel, &uniqueId) == false)
-            continue;
-
-        const bool isVirtual = capabilities & KVASER_CAPABILITY_VIRTUAL;
-
-        // Currently no support for CAN FD devices
-        bool isCanFd = false;
-        if (capabilities & KVASER_CAPABILITY_CANFD)
-            isCanFd = true;
+bool KvaserCanBackend::isPeriodicInHardware(int periodicId) const
+{
+    return m_periodicFrames.value(periodicId).objectBuffer >= 0;
+}
 
-        QString description = QLatin1String(name);
-        if (!isVirtual && numActual > 1) {
-            description += " Channel " + QString::number(channelOnCard + 1);
+int KvaserCanBackend::addAutoResponse(const QCanBusFrame &response)
+{
+    if (m_kvaserHandle < 0) {
+        setError(tr("Cannot add an auto response while not connected"), OperationError);
+        return 0;
+    }
+    if (Q_UNLIKELY(!response.isValid() || response.frameType() != QCanBusFrame::DataFrame
+                   || response.hasFlexibleDataRateFormat())) {
+        setError(tr("Only valid classic data frames can answer remote requests"), WriteError);
+        return 0;
+    }
+    for (const AutoResponse &existing : std::as_const(m_autoResponses)) {
+        if (existing.frameId == response.frameId()
+                && bool(existing.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT) == response.hasExtendedFrameFormat()) {
+            setError(tr("The identifier already has an auto response"), OperationError);
+            return 0;
         }
+    }
 
-        const QString alias;
-        const QCanBusDeviceInfo info = createDeviceInfo(QStringLiteral("kvasercan"),
-                                                        uniqueId,
-                                                        QString::number(serial),
-                                                        description,
-                                                        alias,
-                                                        int(channelOnCard),
-                                                        isVirtual, isCanFd);
-        result.append(std::move(info));
+    const QByteArray payload = response.payload();
+    AutoResponse autoResponse;
+    autoResponse.frameId = response.frameId();
+    autoResponse.flags = messageFlags(response);
+    autoResponse.objectBuffer = startAutoResponseBuffer(autoResponse.frameId, autoResponse.flags,
+                                                        payload.constData(), quint32(payload.size()));
+    if (autoResponse.objectBuffer < 0) {
+        m_responder.insert(autoResponse.frameId, autoResponse.flags, payload.constData(), quint32(payload.size()));
     }
 
-    return result;
+    const int responseId = m_nextAutoResponseId++;
+    m_autoResponses.insert(responseId, autoResponse);
+    return responseId;
 }
 
-QCanBusDevice::CanBusStatus KvaserCanBackend::busStatus()
+// Returns the index of the enabled object buffer, -1 if this CANLIB
+// version or the device cannot answer remote requests itself
+int KvaserCanBackend::startAutoResponseBuffer(quint32 frameId, quint32 flags, const char *payload, quint32 length)
 {
-    if (m_kvaserHandle < 0)
-        return CanBusStatus::Unknown;
-    quint32 flags = 0;
-    KvaserStatus result = canReadStatus(m_kvaserHandle, &flags);
+    if (!canObjBufAllocate || !canObjBufFree || !canObjBufWrite || !canObjBufSetFilter
+            || !canObjBufSetFlags || !canObjBufEnable || !canObjBufDisable) {
+        return -1;
+    }
+
+    const int index = canObjBufAllocate(m_kvaserHandle, KVASER_OBJBUF_AUTO_RESPONSE);
+    if (index < 0)
+        return -1;
+    const quint32 mask = (flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT) ? 0x1FFFFFFF : 0x7FF;
+    KvaserStatus result = canObjBufSetFilter(m_kvaserHandle, index, frameId, mask);
+    if (result == KvaserStatus::OK)
+        result = canObjBufSetFlags(m_kvaserHandle, index, KVASER_OBJBUF_AUTO_RESPONSE_RTR_ONLY);
+    if (result == KvaserStatus::OK)
+        result = canObjBufWrite(m_kvaserHandle, index, int(frameId), payload, length, flags);
+    if (result == KvaserStatus::OK)
+        result = canObjBufEnable(m_kvaserHandle, index);
     if (result != KvaserStatus::OK) {
-        const QString errorString = systemErrorString(result);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Can not query CAN bus status: %ls.",
-            qUtf16Printable(errorString));
-        setError(errorString, CanBusError::ReadError);
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot use an auto response object buffer, answering in software: %ls.",
+                  qUtf16Printable(systemErrorString(result)));
+        canObjBufFree(m_kvaserHandle, index);
+        return -1;
+    }
+    return index;
+}
+
+bool KvaserCanBackend::updateAutoResponsePayload(int responseId, const char *payload, int size)
+{
+    const auto it = m_autoResponses.constFind(responseId);
+    if (it == m_autoResponses.constEnd())
+        return false;
+    if (size < 0 || size > 8) {
+        setError(tr("Invalid payload size"), WriteError);
+        return false;
+    }
+
+    if (it->objectBuffer < 0) {
+        m_responder.setPayload(it->frameId, it->flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT, payload, quint32(size));
+        return true;
+    }
+    const KvaserStatus result = canObjBufWrite(m_kvaserHandle, it->objectBuffer, int(it->frameId), payload,
+                                               quint32(size), it->flags);
+    if (result != KvaserStatus::OK) {
+        setError(systemErrorString(result), WriteError);
+        return false;
+    }
+    return true;
+}
+
+bool KvaserCanBackend::removeAutoResponse(int responseId)
+{
+    const auto it = m_autoResponses.constFind(responseId);
+    if (it == m_autoResponses.constEnd())
+        return false;
+    if (it->objectBuffer >= 0) {
+        canObjBufDisable(m_kvaserHandle, it->objectBuffer);
+        canObjBufFree(m_kvaserHandle, it->objectBuffer);
+    } else {
+        m_responder.remove(it->frameId, it->flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
+    }
+    m_autoResponses.erase(it);
+    return true;
+}
+
+void KvaserCanBackend::removeAutoResponses()
+{
+    while (!m_autoResponses.isEmpty())
+        removeAutoResponse(m_autoResponses.constBegin().key());
+    m_responder.clear();
+}
+
+bool KvaserCanBackend::isAutoResponseInHardware(int responseId) const
+{
+    return m_autoResponses.value(responseId).objectBuffer >= 0;
+}
+
+KvaserCanBackend::PeriodicStatistics KvaserCanBackend::periodicStatistics() const
+{
+    PeriodicStatistics statistics;
+    if (!m_periodicScheduler)
+        return statistics;
+    statistics.frames = m_periodicScheduler->frames();
+    statistics.transmitBufferFull = m_periodicScheduler->transmitBufferFull();
+    statistics.writeFailures = m_periodicScheduler->writeFailures();
+    statistics.missedPeriods = m_periodicScheduler->missedPeriods();
+    const KvaserLatencyHistogram &errors = m_periodicScheduler->errors();
+    statistics.medianJitter = double(errors.percentile(0.5)) / 1000.0;
+    statistics.p99Jitter = double(errors.percentile(0.99)) / 1000.0;
+    statistics.maximumJitter = double(errors.maximum()) / 1000.0;
+    return statistics;
+}
+
+QString KvaserCanBackend::interpretErrorFrame(const QCanBusFrame &errorFrame)
+{
+    if (errorFrame.frameType() != QCanBusFrame::ErrorFrame)
+        return QString();
+
+    const ErrorFrameInfo info = decodeErrorFrame(errorFrame);
+    QStringList errors;
+
+    if (info.protocolType & ERROR_PROTOCOL_BIT)
+        errors.append(tr("bit error"));
+    if (info.protocolType & ERROR_PROTOCOL_BIT0)
+        errors.append(tr("unable to send dominant bit"));
+    if (info.protocolType & ERROR_PROTOCOL_BIT1)
+        errors.append(tr("unable to send recessive bit"));
+    if (info.protocolType & ERROR_PROTOCOL_FORM)
+        errors.append(tr("form error"));
+    if (info.protocolType & ERROR_PROTOCOL_STUFF)
+        errors.append(tr("stuff error"));
+    if (info.protocolLocation == ERROR_LOCATION_CRC_SEQUENCE)
+        errors.append(tr("CRC error"));
+    if (info.hardwareOverrun)
+        errors.append(tr("controller receive overrun"));
+    if (info.softwareOverrun)
+        errors.append(tr("driver receive queue overrun"));
+
+    if (info.controllerStatus & (ERROR_CONTROLLER_TX_PASSIVE | ERROR_CONTROLLER_RX_PASSIVE))
+        errors.append(tr("error passive"));
+    else if (info.controllerStatus & (ERROR_CONTROLLER_TX_WARNING | ERROR_CONTROLLER_RX_WARNING))
+        errors.append(tr("error warning"));
+
+    if (errors.isEmpty())
+        errors.append(tr("Unknown error"));
+
+    return tr("%1 (TX error counter: %2, RX error counter: %3)")
+            .arg(errors.join(QLatin1String(", ")))
+            .arg(info.txErrorCounter)
+            .arg(info.rxErrorCounter);
+}
+
+KvaserCanBackend::ErrorFrameInfo KvaserCanBackend::decodeErrorFrame(const QCanBusFrame &errorFrame)
+{
+    ErrorFrameInfo info;
+    if (errorFrame.frameType() != QCanBusFrame::ErrorFrame)
+        return info;
+
+    info.errors = errorFrame.error();
+    const QByteArray payload = errorFrame.payload();
+    if (payload.size() < 8)
+        return info;
+
+    info.controllerStatus = quint8(payload.at(ErrorControllerStatusByte));
+    info.protocolType = quint8(payload.at(ErrorProtocolTypeByte));
+    info.protocolLocation = quint8(payload.at(ErrorProtocolLocationByte));
+    info.txErrorCounter = quint8(payload.at(ErrorTxCounterByte));
+    info.rxErrorCounter = quint8(payload.at(ErrorRxCounterByte));
+    info.hardwareOverrun = payload.at(ErrorOverrunByte) & ERROR_OVERRUN_HARDWARE;
+    info.softwareOverrun = payload.at(ErrorOverrunByte) & ERROR_OVERRUN_SOFTWARE;
+    return info;
+}
+
+bool KvaserCanBackend::canCreate(QString *errorReason)
+{
+#ifndef LINK_LIBKVASERCAN
+    static bool symbolsResolved = resolveKvaserCanSymbols(kvasercanLibrary(), errorReason);
+    if (Q_UNLIKELY(!symbolsResolved))
+        return false;
+    if (canEnumHardwareEx == nullptr) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Old version of CANLIB detected. Plugging in hardware after the program has started is not supported.");
+        canEnumHardwareEx = canGetNumberOfChannels;
+    }
+#endif
+    canInitializeLibrary();
+    return true;
+}
+
+QList<QCanBusDeviceInfo> KvaserCanBackend::interfaces()
+{
+    if (channelCache()->refresh() != KvaserStatus::OK) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot get number of channels");
+        return QList<QCanBusDeviceInfo>();
+    }
+
+    const QList<KvaserChannelInfo> channels = channelCache()->channels();
+
+    int numActual = 0;
+    for (const KvaserChannelInfo &channel : channels) {
+        const bool isVirtual = channel.capabilities & KVASER_CAPABILITY_VIRTUAL;
+        if (!isVirtual)
+            ++numActual;
+    }
+
+    QList<QCanBusDeviceInfo> result;
+    for (const KvaserChannelInfo &channel : channels) {
+        // Channel numbers change when devices are plugged in or removed, use
+        // unique name based on EAN and serial number instead of "can<n>", so that
+        // the device identifier is always the same.
+        const bool isVirtual = channel.capabilities & KVASER_CAPABILITY_VIRTUAL;
+        const bool isCanFd = channel.capabilities & KVASER_CAPABILITY_CANFD;
+
+        QString description = channel.productName;
+        if (!isVirtual && numActual > 1) {
+            description += " Channel " + QString::number(channel.channelOnCard + 1);
+        }
+
+        const QString alias;
+        const QCanBusDeviceInfo info = createDeviceInfo(QStringLiteral("kvasercan"),
+                                                        channel.uniqueId,
+                                                        QString::number(channel.serial),
+                                                        description,
+                                                        alias,
+                                                        int(channel.channelOnCard),
+                                                        isVirtual, isCanFd);
+        result.append(std::move(info));
+    }
+
+    return result;
+}
+
+// The status snapshot holds the status flags in bits 0 to 15, the transmit
+// and receive error counters in bits 16 to 31 and 32 to 47 and the overrun
+// count in bits 48 to 62. Bit 63 is set if the driver could be read.
+static const quint64 busStateValid = Q_UINT64_C(1) << 63;
+
+static QCanBusDevice::CanBusStatus busStatusFromSnapshot(quint64 snapshot)
+{
+    if (!(snapshot & busStateValid))
+        return QCanBusDevice::CanBusStatus::Unknown;
+    if (snapshot & KVASER_STATUS_BUSOFF)
+        return QCanBusDevice::CanBusStatus::BusOff;
+    if (snapshot & KVASER_STATUS_ERROR_PASSIVE)
+        return QCanBusDevice::CanBusStatus::Error;
+    if (snapshot & KVASER_STATUS_ERROR_WARNING)
+        return QCanBusDevice::CanBusStatus::Warning;
+    if (snapshot & KVASER_STATUS_ERROR_ACTIVE)
+        return QCanBusDevice::CanBusStatus::Good;
+    return QCanBusDevice::CanBusStatus::Unknown;
+}
+
+QCanBusDevice::CanBusStatus KvaserCanBackend::busStatus()
+{
+    if (m_kvaserHandle < 0)
         return CanBusStatus::Unknown;
+    return busStatusFromSnapshot(m_busState.load(std::memory_order_relaxed));
+}
+
+KvaserCanBackend::BusState KvaserCanBackend::busState() const
+{
+    const quint64 snapshot = m_busState.load(std::memory_order_relaxed);
+    BusState state;
+    state.status = busStatusFromSnapshot(snapshot);
+    if (!(snapshot & busStateValid))
+        return state;
+    state.transmitErrorCounter = quint32((snapshot >> 16) & 0xffff);
+    state.receiveErrorCounter = quint32((snapshot >> 32) & 0xffff);
+    state.overruns = quint32((snapshot >> 48) & 0x7fff);
+    state.transmitPending = snapshot & KVASER_STATUS_TX_PENDING;
+    state.receivePending = snapshot & KVASER_STATUS_RX_PENDING;
+    state.transmitError = snapshot & KVASER_STATUS_TX_ERROR;
+    state.receiveError = snapshot & KVASER_STATUS_RX_ERROR;
+    state.hardwareOverrun = snapshot & KVASER_STATUS_HW_OVERRUN;
+    state.softwareOverrun = snapshot & KVASER_STATUS_SW_OVERRUN;
+    return state;
+}
+
+// Reads the status of the first channel, which stands for all channels of
+// an aggregated device
+void KvaserCanBackend::updateBusState()
+{
+    const KvaserHandle handle = m_kvaserHandle;
+    if (handle < 0)
+        return;
+
+    quint64 snapshot = 0;
+    unsigned long flags = 0;
+    if (canReadStatus(handle, &flags) == KvaserStatus::OK) {
+        quint32 transmitErrors = 0;
+        quint32 receiveErrors = 0;
+        quint32 overruns = 0;
+        if (canReadErrorCounters(handle, &transmitErrors, &receiveErrors, &overruns) != KvaserStatus::OK) {
+            transmitErrors = 0;
+            receiveErrors = 0;
+            overruns = 0;
+        }
+        snapshot = busStateValid | quint64(flags & 0xffff)
+                | (quint64(qMin(transmitErrors, quint32(0xffff))) << 16)
+                | (quint64(qMin(receiveErrors, quint32(0xffff))) << 32)
+                | (quint64(qMin(overruns, quint32(0x7fff))) << 48);
     }
-    if (flags & KVASER_STATUS_BUSOFF)
-        return CanBusStatus::BusOff;
-    else if (flags & KVASER_STATUS_ERROR_PASSIVE)
-        return CanBusStatus::Error;
-    else if (flags & KVASER_STATUS_ERROR_WARNING)
-        return CanBusStatus::Warning;
-    else if (flags & KVASER_STATUS_ERROR_ACTIVE)
-        return CanBusStatus::Good;
 
-    qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Unknown CAN bus status flags: 0x%08x", flags);
-    return CanBusStatus::Unknown;
+    m_busState.store(snapshot, std::memory_order_relaxed);
 }
 
 void KvaserCanBackend::resetController()
@@ -404,87 +1192,1056 @@ void KvaserCanBackend::resetController()
     }
 }
 
+void KvaserCanBackend::setMessagesPending()
+{
+    // Only the first notification since the last drain is stamped
+    if (m_latencyTracing.load(std::memory_order_relaxed)) {
+        qint64 unstamped = 0;
+        m_traceNotifyTime.compare_exchange_strong(unstamped, hostNanoSeconds(), std::memory_order_relaxed);
+    }
+
+    if (m_receiveThread)
+        m_receiveThread->wakeUp();
+    else
+        setMessagesAvailable();
+}
+
 void KvaserCanBackend::onMessagesAvailable()
 {
-    QList<QCanBusFrame> newFrames;
+    // Cleared before draining, so that a notification arriving during the
+    // drain posts another call instead of being lost.
+    m_messagesAvailable.store(false, std::memory_order_release);
 
-    m_messagesAvailable = false;
+    if (m_kvaserHandle < 0)
+        return;
 
-    for (;;) {
-        quint32 frameId = 0;
-        char buffer[64];
+    if (m_activeDeliveryMode == DirectDelivery) {
+        emit framesReceived();
+        return;
+    }
+
+    quint64 drainLimit = std::numeric_limits<quint64>::max();
+    if (m_overflowPolicy == StopDraining) {
+        const qint64 limit = receiveQueueLimit();
+        if (limit > 0) {
+            const qint64 room = limit - framesAvailable() - m_receivedFrames.size();
+            if (room <= 0) {
+                m_receivePollTimer->start();
+                return;
+            }
+            drainLimit = quint64(room);
+        }
+    }
+
+    const bool tracing = m_latencyTracing.load(std::memory_order_relaxed);
+    qint64 notifyTime = 0;
+    qint64 drainTime = 0;
+    if (tracing) {
+        notifyTime = m_traceNotifyTime.exchange(0, std::memory_order_relaxed);
+        drainTime = hostNanoSeconds();
+    }
+
+    const bool batchWasEmpty = m_receivedFrames.isEmpty();
+    m_errorCountersValid = false;
+
+    synchronizeTimestamps();
+    if (!m_supervisor.isEmpty())
+        m_drainTime = hostMicroSeconds();
+    if (m_capture.isOpen())
+        m_capture.rotateIfDue(hostMicroSeconds());
+
+    // A channel opened without KVASER_OPEN_CANFD never delivers more than
+    // 8 data bytes, so classic traffic is drained through 8 byte buffers.
+    quint64 messages = 0;
+    if (!m_members.empty())
+        messages = drainMembers(drainLimit);
+    else
+        messages = m_channelIsCanFd ? drainMessages<64>(drainLimit) : drainMessages<8>(drainLimit);
+    if (messages == drainLimit)
+        m_receivePollTimer->start();
+
+    if (tracing && messages > 0) {
+        const qint64 readTime = hostNanoSeconds();
+        if (notifyTime > 0)
+            m_latency[CallbackToDrainStage].record(drainTime - notifyTime);
+        m_latency[DrainToReadCompleteStage].record(readTime - drainTime);
+        if (batchWasEmpty) {
+            m_traceBatchNotifyTime = notifyTime;
+            m_traceBatchReadTime = readTime;
+        }
+    }
+
+    if (m_latestValues.isAllocated()) {
+        const quint64 sequence = m_latestValues.sequence();
+        if (sequence != m_notifiedSequence) {
+            m_notifiedSequence = sequence;
+            emit latestFramesUpdated(sequence);
+        }
+    }
+
+    if (m_receivedFrames.isEmpty())
+        return;
+
+    if (batchWasEmpty)
+        m_receiveBatchAge.start();
+
+    if (receiveBatchDue()) {
+        flushReceivedFrames();
+    } else if (!m_receiveBatchTimer->isActive()) {
+        // Rounded down, the timer delivers up to a millisecond early rather
+        // than late. Less than a millisecond left delivers on the next pass
+        // of the event loop.
+        const qint64 remaining = receiveBatchTimeout() - m_receiveBatchAge.nsecsElapsed() / 1000;
+        m_receiveBatchTimer->start(int(qMax(qint64(0), remaining / 1000)));
+    }
+}
+
+// In microseconds, 0 if every drain is delivered immediately
+qint64 KvaserCanBackend::receiveBatchTimeout() const
+{
+    if (m_receiveBatchTimeout > 0)
+        return m_receiveBatchTimeout;
+    return m_receiveBatchSize > 0 ? defaultReceiveBatchTimeout : 0;
+}
+
+bool KvaserCanBackend::receiveBatchDue() const
+{
+    if (m_receiveBatchSize > 0 && quint32(m_receivedFrames.size()) >= m_receiveBatchSize)
+        return true;
+    return m_receiveBatchAge.nsecsElapsed() / 1000 >= receiveBatchTimeout();
+}
+
+void KvaserCanBackend::flushReceivedFrames()
+{
+    m_receiveBatchTimer->stop();
+
+    if (m_receivedFrames.isEmpty())
+        return;
+
+    dropOverflowingFrames();
+    if (!m_receivedFrames.isEmpty())
+        enqueueReceivedFrames(m_receivedFrames);
+    // The list is not shared after being enqueued, so clearing it keeps
+    // the capacity of this drain for the next one.
+    m_receivedFrames.clear();
+
+    if (m_latencyTracing.load(std::memory_order_relaxed) && m_traceBatchReadTime > 0) {
+        const qint64 enqueueTime = hostNanoSeconds();
+        m_latency[ReadCompleteToEnqueueStage].record(enqueueTime - m_traceBatchReadTime);
+        if (m_traceBatchNotifyTime > 0)
+            m_latency[CallbackToEnqueueStage].record(enqueueTime - m_traceBatchNotifyTime);
+    }
+    m_traceBatchNotifyTime = 0;
+    m_traceBatchReadTime = 0;
+}
+
+qint64 KvaserCanBackend::receiveQueueLimit() const
+{
+    qint64 limit = m_receiveQueueLimit;
+    if (m_receiveQueueByteLimit > 0) {
+        // The frame itself and the heap block holding its payload
+        const qint64 frameSize = qint64(sizeof(QCanBusFrame)) + 32 + (m_channelIsCanFd ? 64 : 8);
+        const qint64 byteLimit = qMax(qint64(1), qint64(m_receiveQueueByteLimit) / frameSize);
+        limit = limit > 0 ? qMin(limit, byteLimit) : byteLimit;
+    }
+    return limit;
+}
+
+// Makes room for the batch in the receive queue. StopDraining normally
+// never overfills the queue and drops like DropNewestFrames otherwise.
+void KvaserCanBackend::dropOverflowingFrames()
+{
+    const qint64 limit = receiveQueueLimit();
+    if (limit <= 0)
+        return;
+
+    const qint64 queued = framesAvailable();
+    const qint64 batch = m_receivedFrames.size();
+    const qint64 excess = queued + batch - limit;
+    if (excess <= 0)
+        return;
+
+    qint64 dropped = 0;
+    if (m_overflowPolicy == DropOldestFrames) {
+        // A batch larger than the whole queue first loses its own oldest frames
+        const qint64 batchExcess = qMax(batch - limit, qint64(0));
+        if (batchExcess > 0)
+            m_receivedFrames.remove(0, batchExcess);
+        dropped = batchExcess;
+        for (; dropped < excess; ++dropped)
+            readFrame();
+    } else {
+        dropped = qMin(excess, batch);
+        m_receivedFrames.resize(batch - dropped);
+    }
+
+    m_statistics.droppedFrames.add(quint64(dropped));
+    emit framesDropped(dropped);
+}
+
+QString KvaserCanBackend::latencyReport() const
+{
+    static const char *const stageNames[LatencyStageCount] = {
+        "callback to drain",
+        "drain to read complete",
+        "read complete to enqueue",
+        "callback to enqueue"
+    };
+
+    QString report;
+    for (int stage = 0; stage < LatencyStageCount; ++stage) {
+        const KvaserLatencyHistogram &histogram = m_latency[stage];
+        report += QStringLiteral("%1: count %2, p50 %3 us, p90 %4 us, p99 %5 us, p99.9 %6 us, max %7 us\n")
+                .arg(QLatin1String(stageNames[stage]))
+                .arg(histogram.count())
+                .arg(double(histogram.percentile(0.5)) / 1000.0, 0, 'f', 1)
+                .arg(double(histogram.percentile(0.9)) / 1000.0, 0, 'f', 1)
+                .arg(double(histogram.percentile(0.99)) / 1000.0, 0, 'f', 1)
+                .arg(double(histogram.percentile(0.999)) / 1000.0, 0, 'f', 1)
+                .arg(double(histogram.maximum()) / 1000.0, 0, 'f', 1);
+    }
+    return report;
+}
+
+void KvaserCanBackend::resetLatencyHistograms()
+{
+    for (KvaserLatencyHistogram &histogram : m_latency)
+        histogram.reset();
+}
+
+// Returns the number of messages read, at most maxMessages
+template <int MaxPayloadSize>
+quint64 KvaserCanBackend::drainMessages(quint64 maxMessages)
+{
+    KvaserMessage<MaxPayloadSize> message;
+    quint64 messages = 0;
+
+    if (m_receiveThread) {
+        auto receiveThread = static_cast<KvaserReceiveThread<MaxPayloadSize> *>(m_receiveThread);
+        while (messages < maxMessages && receiveThread->pop(&message)) {
+            appendReceivedFrame(message, m_timestamps.toMicroSeconds(message.time), 0);
+            ++messages;
+        }
+        resumeReceiveThread();
+        recordDrain(messages);
+        return messages;
+    }
+
+    while (messages < maxMessages) {
+        const KvaserStatus result = readMessage(m_kvaserHandle, &message);
+        if (result == KvaserStatus::NoMessages)
+            break;
+        if (result != KvaserStatus::OK) {
+            setError(systemErrorString(result), ReadError);
+            break;
+        }
+        appendReceivedFrame(message, m_timestamps.toMicroSeconds(message.time), 0);
+        ++messages;
+    }
+    recordDrain(messages);
+    return messages;
+}
+
+// Merges the messages waiting in the member channels into one stream
+// ordered by timestamp and passes at most maxMessages of them to sink.
+// Every channel delivers its own messages in order, so only the oldest
+// unmerged message of each channel takes part in the comparison. For the
+// handful of channels of a device a linear scan is cheaper than a heap.
+//
+// The window is measured against the host clock extrapolation of
+// currentTime(), reading the device timer on every drain would cost a
+// driver call per notification.
+template <typename Sink>
+quint64 KvaserCanBackend::mergeMembers(quint64 maxMessages, Sink sink)
+{
+    qint64 releaseTime = std::numeric_limits<qint64>::max();
+    if (m_mergeWindow > 0 && m_members.front().timestamps.currentTime(&releaseTime))
+        releaseTime -= m_mergeWindow;
+
+    for (KvaserMemberChannel &member : m_members)
+        member.drained = false;
+
+    quint64 messages = 0;
+    bool heldBack = false;
+    while (messages < maxMessages) {
+        KvaserMemberChannel *oldest = nullptr;
+        for (KvaserMemberChannel &member : m_members) {
+            if (!member.hasHead && !member.drained)
+                fetchHead(&member);
+            if (member.hasHead && (!oldest || member.headTimestamp < oldest->headTimestamp))
+                oldest = &member;
+        }
+        if (!oldest)
+            break;
+        if (oldest->headTimestamp > releaseTime) {
+            heldBack = true;
+            break;
+        }
+        oldest->hasHead = false;
+        sink(oldest->head, oldest->headTimestamp, quint8(oldest - m_members.data()));
+        ++messages;
+    }
+
+    // Nothing notifies the backend when a held back message becomes due
+    if (heldBack)
+        m_receivePollTimer->start();
+    return messages;
+}
+
+void KvaserCanBackend::fetchHead(KvaserMemberChannel *member)
+{
+    const KvaserStatus result = readMessage(member->handle, &member->head);
+    if (result != KvaserStatus::OK) {
+        member->drained = true;
+        if (result != KvaserStatus::NoMessages)
+            setError(systemErrorString(result), ReadError);
+        return;
+    }
+    // Classic CAN reports the raw DLC, which may be up to 15 for 8 bytes
+    if (!m_channelIsCanFd)
+        member->head.dlc = qMin(member->head.dlc, quint32(8));
+    member->headTimestamp = member->timestamps.toMicroSeconds(member->head.time);
+    member->hasHead = true;
+}
+
+quint64 KvaserCanBackend::drainMembers(quint64 maxMessages)
+{
+    const quint64 messages = mergeMembers(maxMessages, [this](const KvaserMessage<64> &message,
+                                                              qint64 timestamp, quint8 channel) {
+        appendReceivedFrame(message, timestamp, channel);
+    });
+    recordDrain(messages);
+    return messages;
+}
+
+void KvaserCanBackend::recordDrain(quint64 messages)
+{
+    m_statistics.drains.add(1);
+    const int bucket = qMin(int(64 - qCountLeadingZeroBits(messages)), DrainBatchBuckets - 1);
+    m_statistics.drainBatchSizes[bucket].add(1);
+}
+
+static QCanBusFrame toCanBusFrame(const KvaserCachedFrame &cached)
+{
+    QCanBusFrame frame(cached.frameId, QByteArray(cached.payload, int(cached.payloadSize)));
+    if (cached.flags & KvaserLatestValueCache::RemoteRequest)
+        frame.setFrameType(QCanBusFrame::RemoteRequestFrame);
+    frame.setExtendedFrameFormat(cached.flags & KvaserLatestValueCache::ExtendedFrameFormat);
+    frame.setFlexibleDataRateFormat(cached.flags & KvaserLatestValueCache::FlexibleDataRateFormat);
+    frame.setBitrateSwitch(cached.flags & KvaserLatestValueCache::BitrateSwitch);
+    frame.setTimeStamp(QCanBusFrame::TimeStamp::fromMicroSeconds(cached.timestamp));
+    return frame;
+}
+
+bool KvaserCanBackend::latestFrame(quint32 frameId, bool extendedFrameFormat, QCanBusFrame *frame,
+                                   quint64 *sequence) const
+{
+    KvaserCachedFrame cached;
+    if (!m_latestValues.read(frameId, extendedFrameFormat, &cached))
+        return false;
+    *frame = toCanBusFrame(cached);
+    if (sequence)
+        *sequence = cached.sequence;
+    return true;
+}
+
+QList<QCanBusFrame> KvaserCanBackend::latestFrames(quint64 sinceSequence, quint64 *sequence) const
+{
+    QList<QCanBusFrame> frames;
+    quint64 newest = sinceSequence;
+    if (m_latestValues.isAllocated()) {
+        m_latestValues.forEachSince(sinceSequence, [&](const KvaserCachedFrame &cached) {
+            frames.append(toCanBusFrame(cached));
+            newest = qMax(newest, cached.sequence);
+        });
+    }
+    if (sequence)
+        *sequence = newest;
+    return frames;
+}
+
+QList<KvaserTrafficEntry> KvaserCanBackend::trafficProfile() const
+{
+    quint32 dataBitRate = 0;
+    if (m_canFd)
+        dataBitRate = configurationParameter(DataBitRateKey).toUInt();
+    return m_profiler.report(configurationParameter(BitRateKey).toUInt(), dataBitRate);
+}
+
+QString KvaserCanBackend::trafficReport() const
+{
+    return KvaserTrafficProfiler::format(trafficProfile());
+}
+
+void KvaserCanBackend::resetTrafficProfile()
+{
+    m_profiler.clear();
+}
+
+KvaserCanBackend::Statistics KvaserCanBackend::statistics() const
+{
+    Statistics statistics;
+    statistics.receivedFrames = m_statistics.receivedFrames.load();
+    statistics.receivedBytes = m_statistics.receivedBytes.load();
+    statistics.filteredFrames = m_statistics.filteredFrames.load();
+    statistics.errorFrames = m_statistics.errorFrames.load();
+    statistics.hardwareOverruns = m_statistics.hardwareOverruns.load();
+    statistics.softwareOverruns = m_statistics.softwareOverruns.load();
+    statistics.writtenFrames = m_statistics.writtenFrames.load();
+    statistics.writtenBytes = m_statistics.writtenBytes.load();
+    statistics.writeFailures = m_statistics.writeFailures.load();
+    statistics.transmitBufferFull = m_statistics.transmitBufferFull.load();
+    statistics.drains = m_statistics.drains.load();
+    for (int bucket = 0; bucket < DrainBatchBuckets; ++bucket)
+        statistics.drainBatchSizes[bucket] = m_statistics.drainBatchSizes[bucket].load();
+    statistics.cacheOverflows = m_statistics.cacheOverflows.load();
+    statistics.droppedFrames = m_statistics.droppedFrames.load();
+    statistics.autoResponses = m_responder.responses();
+    statistics.autoResponseFailures = m_responder.failures();
+    return statistics;
+}
+
+void KvaserCanBackend::resetStatistics()
+{
+    m_statistics.receivedFrames.reset();
+    m_statistics.receivedBytes.reset();
+    m_statistics.filteredFrames.reset();
+    m_statistics.errorFrames.reset();
+    m_statistics.hardwareOverruns.reset();
+    m_statistics.softwareOverruns.reset();
+    m_statistics.writtenFrames.reset();
+    m_statistics.writtenBytes.reset();
+    m_statistics.writeFailures.reset();
+    m_statistics.transmitBufferFull.reset();
+    m_statistics.drains.reset();
+    for (KvaserCounter &counter : m_statistics.drainBatchSizes)
+        counter.reset();
+    m_statistics.cacheOverflows.reset();
+    m_statistics.droppedFrames.reset();
+}
+
+template <int MaxPayloadSize>
+void KvaserCanBackend::appendReceivedFrame(const KvaserMessage<MaxPayloadSize> &message, qint64 timestamp,
+                                           quint8 channel)
+{
+    // Classic CAN reports the raw DLC, which may be up to 15 for 8 bytes
+    const quint32 payloadSize = qMin(message.dlc, quint32(MaxPayloadSize));
+    if (!acceptMessage(message.id, message.dlc, payloadSize, message.flags, timestamp, channel, message.payload))
+        return;
+
+    if (m_activeDeliveryMode != QueuedDelivery && !(message.flags & KVASER_MESSAGE_ERROR_FRAME)) {
+        quint32 cacheFlags = 0;
+        if (message.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT)
+            cacheFlags |= KvaserLatestValueCache::ExtendedFrameFormat;
+        if (message.flags & KVASER_MESSAGE_CANFD)
+            cacheFlags |= KvaserLatestValueCache::FlexibleDataRateFormat;
+        if (message.flags & KVASER_MESSAGE_BIT_RATE_SWITCH)
+            cacheFlags |= KvaserLatestValueCache::BitrateSwitch;
+        if (message.flags & KVASER_MESSAGE_REMOTE_REQUEST)
+            cacheFlags |= KvaserLatestValueCache::RemoteRequest;
+        if (!m_latestValues.update(quint32(message.id), cacheFlags, message.payload, payloadSize, timestamp))
+            m_statistics.cacheOverflows.add(1);
+        if (m_activeDeliveryMode == ConflatedDelivery)
+            return;
+    }
+
+    QCanBusFrame::FrameType frameType = QCanBusFrame::DataFrame;
+    if (message.flags & KVASER_MESSAGE_REMOTE_REQUEST)
+        frameType = QCanBusFrame::RemoteRequestFrame;
+    if (message.flags & KVASER_MESSAGE_ERROR_FRAME)
+        frameType = QCanBusFrame::ErrorFrame;
+
+    QCanBusFrame &frame = m_receivedFrames.emplaceBack(frameType);
+    frame.setTimeStamp(QCanBusFrame::TimeStamp::fromMicroSeconds(timestamp));
+    if (Q_UNLIKELY(frameType == QCanBusFrame::ErrorFrame)) {
+        setErrorFrame(&frame, message.flags);
+        return;
+    }
+    frame.setExtendedFrameFormat(message.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
+    frame.setFlexibleDataRateFormat(message.flags & KVASER_MESSAGE_CANFD);
+    frame.setBitrateSwitch(message.flags & KVASER_MESSAGE_BIT_RATE_SWITCH);
+    frame.setFrameId(quint32(message.id));
+    // The one heap allocation left per frame, the frame owns its payload
+    // and the message buffer is reused for the next read
+    frame.setPayload(QByteArray(message.payload, payloadSize));
+}
+
+// Counts the message and runs it through capture, profiler, cycle time
+// supervision and software filter. Returns false if the filter rejects it.
+bool KvaserCanBackend::acceptMessage(long id, quint32 dlc, quint32 payloadSize, quint32 flags,
+                                     qint64 timestamp, quint8 channel, const char *payload)
+{
+    m_statistics.receivedFrames.add(1);
+    m_statistics.receivedBytes.add(payloadSize);
+    // The driver flags the first message after an overrun
+    if (Q_UNLIKELY(flags & (KVASER_MESSAGE_ERROR_HW_OVERRUN | KVASER_MESSAGE_ERROR_SW_OVERRUN))) {
+        if (flags & KVASER_MESSAGE_ERROR_HW_OVERRUN)
+            m_statistics.hardwareOverruns.add(1);
+        if (flags & KVASER_MESSAGE_ERROR_SW_OVERRUN)
+            m_statistics.softwareOverruns.add(1);
+    }
+
+    if (m_capture.isOpen())
+        m_capture.append(quint32(id), dlc, flags, payloadSize, channel, timestamp, payload);
+
+    // The receive thread answers as soon as it read the remote request.
+    // Auto responses belong to the first channel of an aggregated device.
+    if (Q_UNLIKELY(flags & KVASER_MESSAGE_REMOTE_REQUEST) && !m_receiveThread && channel == 0)
+        respondToRemoteRequest(m_kvaserHandle, id, flags);
+
+    if (m_profileTraffic && !(flags & KVASER_MESSAGE_ERROR_FRAME)) {
+        m_profiler.record(quint32(id), flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT,
+                          flags & KVASER_MESSAGE_REMOTE_REQUEST, flags & KVASER_MESSAGE_CANFD,
+                          flags & KVASER_MESSAGE_BIT_RATE_SWITCH, payloadSize, timestamp);
+    }
+    if (!m_supervisor.isEmpty() && !(flags & KVASER_MESSAGE_ERROR_FRAME))
+        m_supervisor.received(quint32(id), flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT, m_drainTime);
+
+    if (!m_filter.accepts(id, flags)) {
+        m_statistics.filteredFrames.add(1);
+        return false;
+    }
+    return true;
+}
+
+void KvaserCanBackend::setErrorFrame(QCanBusFrame *frame, quint32 flags)
+{
+    char payload[8];
+    frame->setError(errorFramePayload(flags, payload));
+    frame->setPayload(QByteArray(payload, sizeof(payload)));
+}
+
+// Fills in the SocketCAN compatible 8 byte payload of an error frame and
+// returns its error class. The error counters are read at most once per
+// drain.
+QCanBusFrame::FrameErrors KvaserCanBackend::errorFramePayload(quint32 flags, char *payload)
+{
+    m_statistics.errorFrames.add(1);
+
+    if (!m_errorCountersValid) {
+        quint32 overruns = 0;
+        if (canReadErrorCounters(m_kvaserHandle, &m_txErrorCounter, &m_rxErrorCounter, &overruns) != KvaserStatus::OK) {
+            m_txErrorCounter = 0;
+            m_rxErrorCounter = 0;
+        }
+        m_errorCountersValid = true;
+    }
+
+    memset(payload, 0, 8);
+    QCanBusFrame::FrameErrors errors = QCanBusFrame::NoError;
+
+    quint8 protocolType = 0;
+    if (flags & KVASER_MESSAGE_ERROR_STUFF)
+        protocolType |= ERROR_PROTOCOL_STUFF;
+    if (flags & KVASER_MESSAGE_ERROR_FORM)
+        protocolType |= ERROR_PROTOCOL_FORM;
+    if (flags & KVASER_MESSAGE_ERROR_BIT0)
+        protocolType |= ERROR_PROTOCOL_BIT | ERROR_PROTOCOL_BIT0;
+    if (flags & KVASER_MESSAGE_ERROR_BIT1)
+        protocolType |= ERROR_PROTOCOL_BIT | ERROR_PROTOCOL_BIT1;
+    payload[ErrorProtocolTypeByte] = char(protocolType);
+    if (flags & KVASER_MESSAGE_ERROR_CRC)
+        payload[ErrorProtocolLocationByte] = char(ERROR_LOCATION_CRC_SEQUENCE);
+    if (protocolType || (flags & KVASER_MESSAGE_ERROR_CRC))
+        errors |= QCanBusFrame::ProtocolViolationError;
+
+    quint8 controllerStatus = 0;
+    quint8 overrun = 0;
+    if (flags & KVASER_MESSAGE_ERROR_HW_OVERRUN)
+        overrun |= ERROR_OVERRUN_HARDWARE;
+    if (flags & KVASER_MESSAGE_ERROR_SW_OVERRUN)
+        overrun |= ERROR_OVERRUN_SOFTWARE;
+    if (overrun)
+        controllerStatus |= ERROR_CONTROLLER_RX_OVERFLOW;
+    if (m_txErrorCounter >= 128)
+        controllerStatus |= ERROR_CONTROLLER_TX_PASSIVE;
+    else if (m_txErrorCounter >= 96)
+        controllerStatus |= ERROR_CONTROLLER_TX_WARNING;
+    if (m_rxErrorCounter >= 128)
+        controllerStatus |= ERROR_CONTROLLER_RX_PASSIVE;
+    else if (m_rxErrorCounter >= 96)
+        controllerStatus |= ERROR_CONTROLLER_RX_WARNING;
+    payload[ErrorControllerStatusByte] = char(controllerStatus);
+    payload[ErrorOverrunByte] = char(overrun);
+    if (controllerStatus)
+        errors |= QCanBusFrame::ControllerError;
+
+    payload[ErrorTxCounterByte] = char(qMin(m_txErrorCounter, quint32(255)));
+    payload[ErrorRxCounterByte] = char(qMin(m_rxErrorCounter, quint32(255)));
+
+    if (!errors)
+        errors = QCanBusFrame::UnknownError;
+    return errors;
+}
+
+qint64 KvaserCanBackend::readFrames(ClassicFrameRecord *records, qint64 maxRecords)
+{
+    return readRecords(records, maxRecords);
+}
+
+qint64 KvaserCanBackend::readFrames(FdFrameRecord *records, qint64 maxRecords)
+{
+    return readRecords(records, maxRecords);
+}
+
+template <int RecordPayloadSize>
+qint64 KvaserCanBackend::readRecords(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords)
+{
+    if (m_kvaserHandle < 0)
+        return -1;
+    if (maxRecords <= 0)
+        return 0;
+
+    m_errorCountersValid = false;
+    synchronizeTimestamps();
+    if (!m_supervisor.isEmpty())
+        m_drainTime = hostMicroSeconds();
+    if (m_capture.isOpen())
+        m_capture.rotateIfDue(hostMicroSeconds());
+
+    if (!m_members.empty())
+        return readRecordsMerged(records, maxRecords);
+
+    // canRead writes the payload straight into the record, unless a CAN FD
+    // message could overflow a classic record or the receive thread owns
+    // the driver queue.
+    if (m_channelIsCanFd && (m_receiveThread || RecordPayloadSize < 64))
+        return readRecordsCopied<64>(records, maxRecords);
+    if (m_receiveThread)
+        return readRecordsCopied<8>(records, maxRecords);
+    return readRecordsDirect(records, maxRecords);
+}
+
+template <int RecordPayloadSize>
+qint64 KvaserCanBackend::readRecordsDirect(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords)
+{
+    qint64 count = 0;
+    quint64 messages = 0;
+    while (count < maxRecords) {
+        FrameRecord<RecordPayloadSize> *record = records + count;
+        long id = 0;
         quint32 dlc = 0;
         quint32 flags = 0;
-        quint32 time = 0;
-        KvaserStatus result = canRead(m_kvaserHandle, &frameId, buffer, &dlc, &flags, &time);
+        unsigned long time = 0;
+        const KvaserStatus result = canRead(m_kvaserHandle, &id, record->payload, &dlc, &flags, &time);
         if (result == KvaserStatus::NoMessages)
             break;
         if (result != KvaserStatus::OK) {
             setError(systemErrorString(result), ReadError);
             break;
         }
-        QCanBusFrame frame;
-        frame.setTimeStamp(QCanBusFrame::TimeStamp::fromMicroSeconds((qint64)time * 1000));
-        frame.setFrameType(QCanBusFrame::DataFrame);
-        if (flags & KVASER_MESSAGE_REMOTE_REQUEST)
-            frame.setFrameType(QCanBusFrame::RemoteRequestFrame);
-        if (flags & KVASER_MESSAGE_ERROR_FRAME)
-            frame.setFrameType(QCanBusFrame::ErrorFrame);
-        frame.setExtendedFrameFormat(flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
-        frame.setBitrateSwitch(flags & KVASER_MESSAGE_CANFD);
-        frame.setFlexibleDataRateFormat(flags & KVASER_MESSAGE_BIT_RATE_SWITCH);
-        frame.setFrameId(frameId);
-        frame.setPayload(QByteArray(buffer, dlc));
-        newFrames.append(frame);
+        ++messages;
+        // A filtered message is overwritten by the next one
+        if (fillRecord(record, id, dlc, flags, m_timestamps.toMicroSeconds(time), 0))
+            ++count;
     }
+    recordDrain(messages);
+    return count;
+}
 
-    enqueueReceivedFrames(newFrames);
+template <int MaxPayloadSize, int RecordPayloadSize>
+qint64 KvaserCanBackend::readRecordsCopied(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords)
+{
+    auto receiveThread = static_cast<KvaserReceiveThread<MaxPayloadSize> *>(m_receiveThread);
+    KvaserMessage<MaxPayloadSize> message;
+    qint64 count = 0;
+    quint64 messages = 0;
+    while (count < maxRecords) {
+        if (receiveThread) {
+            if (!receiveThread->pop(&message))
+                break;
+        } else {
+            const KvaserStatus result = readMessage(m_kvaserHandle, &message);
+            if (result == KvaserStatus::NoMessages)
+                break;
+            if (result != KvaserStatus::OK) {
+                setError(systemErrorString(result), ReadError);
+                break;
+            }
+        }
+        ++messages;
+        FrameRecord<RecordPayloadSize> *record = records + count;
+        memcpy(record->payload, message.payload, qMin(message.dlc, quint32(RecordPayloadSize)));
+        if (fillRecord(record, message.id, message.dlc, message.flags,
+                       m_timestamps.toMicroSeconds(message.time), 0)) {
+            if (message.dlc > quint32(RecordPayloadSize) && (message.flags & KVASER_MESSAGE_CANFD))
+                record->flags |= RecordTruncated;
+            ++count;
+        }
+    }
+    if (receiveThread)
+        resumeReceiveThread();
+    recordDrain(messages);
+    return count;
 }
 
-void KvaserCanBackend::onStatusChanged()
+template <int RecordPayloadSize>
+qint64 KvaserCanBackend::readRecordsMerged(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords)
 {
-#if 0
-    quint32 flags = 0;
-    KvaserStatus result = canReadStatus(m_kvaserHandle, &flags);
-    if (result == KvaserStatus::OK) {
-        qDebug() << Q_FUNC_INFO
-                 << (flags & KVASER_STATUS_ERROR_PASSIVE ? "ERROR_PASSIVE" : "")
-                 << (flags & KVASER_STATUS_BUSOFF ? "BUS_OFF" : "")
-                 << (flags & KVASER_STATUS_ERROR_WARNING ? "ERROR_WARNING" : "")
-                 << (flags & KVASER_STATUS_ERROR_ACTIVE ? "ERROR_ACTIVE" : "")
-                 << (flags & KVASER_STATUS_TX_PENDING ? "TX_PENDING" : "")
-                 << (flags & KVASER_STATUS_RX_PENDING ? "RX_PENDING" : "")
-                 << (flags & KVASER_STATUS_TX_ERROR ? "TX_ERROR" : "")
-                 << (flags & KVASER_STATUS_RX_ERROR ? "RX_ERROR" : "")
-                 << (flags & KVASER_STATUS_HW_OVERRUN ? "HW_OVERRUN" : "")
-                 << (flags & KVASER_STATUS_SW_OVERRUN ? "SW_OVERRUN" : "");
-    } else {
-        setError(systemErrorString(result), ConnectionError);
+    qint64 count = 0;
+    quint64 messages = 0;
+    // Filtered messages leave room for another pass
+    while (count < maxRecords) {
+        const quint64 merged = mergeMembers(quint64(maxRecords - count), [&](const KvaserMessage<64> &message,
+                                                                             qint64 timestamp, quint8 channel) {
+            FrameRecord<RecordPayloadSize> *record = records + count;
+            memcpy(record->payload, message.payload, qMin(message.dlc, quint32(RecordPayloadSize)));
+            if (fillRecord(record, message.id, message.dlc, message.flags, timestamp, channel)) {
+                if (message.dlc > quint32(RecordPayloadSize) && (message.flags & KVASER_MESSAGE_CANFD))
+                    record->flags |= RecordTruncated;
+                ++count;
+            }
+        });
+        if (merged == 0)
+            break;
+        messages += merged;
     }
-#endif
+    recordDrain(messages);
+    return count;
 }
 
-void KvaserCanBackend::onBusOnOff()
+// Completes a record whose payload was already stored, returns false if
+// the software filter rejects the message
+template <int RecordPayloadSize>
+bool KvaserCanBackend::fillRecord(FrameRecord<RecordPayloadSize> *record, long id, quint32 dlc, quint32 flags,
+                                  qint64 timestamp, quint8 channel)
 {
-    quint32 flags = 0;
-    KvaserStatus result = canReadStatus(m_kvaserHandle, &flags);
-    if (result == KvaserStatus::OK) {
-        if (flags & KVASER_STATUS_BUSOFF) {
-            setError(tr("Bus off"), ConnectionError);
-        }
-    } else {
+    const quint32 payloadSize = qMin(dlc, quint32(RecordPayloadSize));
+    if (!acceptMessage(id, dlc, payloadSize, flags, timestamp, channel, record->payload))
+        return false;
+
+    quint16 recordFlags = 0;
+    if (flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT)
+        recordFlags |= RecordExtendedFrameFormat;
+    if (flags & KVASER_MESSAGE_CANFD)
+        recordFlags |= RecordFlexibleDataRateFormat;
+    if (flags & KVASER_MESSAGE_BIT_RATE_SWITCH)
+        recordFlags |= RecordBitrateSwitch;
+    if (flags & KVASER_MESSAGE_ERROR_STATE_INDICATOR)
+        recordFlags |= RecordErrorStateIndicator;
+    if (flags & KVASER_MESSAGE_REMOTE_REQUEST)
+        recordFlags |= RecordRemoteRequest;
+
+    record->frameId = quint32(id);
+    record->length = quint8(payloadSize);
+    record->channel = channel;
+    record->timestamp = timestamp;
+    if (Q_UNLIKELY(flags & KVASER_MESSAGE_ERROR_FRAME)) {
+        recordFlags |= RecordErrorFrame;
+        record->frameId = 0;
+        record->length = 8;
+        errorFramePayload(flags, record->payload);
+    }
+    record->flags = recordFlags;
+    return true;
+}
+
+// Answers in software through the handle of the thread that read the
+// remote request. The CANLIB entry points are resolved in this file.
+void KvaserCanBackend::respondToRemoteRequest(KvaserHandle handle, long id, quint32 flags)
+{
+    m_responder.respond(id, flags, [handle](quint32 frameId, const char *payload, quint32 length,
+                                            quint32 responseFlags) {
+        return canWrite(handle, long(frameId), payload, length, responseFlags);
+    });
+}
+
+// The thread reads from a handle of its own, the backend handle stays with
+// the Qt thread for writing, status and timer. Own frames reach the reader
+// through the local transmit echo instead of as acknowledgements.
+bool KvaserCanBackend::startReceiveThread()
+{
+    m_receiveHandle = openThreadHandle(configurationParameter(ReceiveOwnKey).toBool());
+    if (m_receiveHandle < 0)
+        return false;
+
+    auto notify = [this]() { setMessagesAvailable(); };
+    auto remoteRequest = [this](KvaserHandle handle, long id, quint32 flags) {
+        respondToRemoteRequest(handle, id, flags);
+    };
+    if (m_channelIsCanFd)
+        m_receiveThread = new KvaserReceiveThread<64>(m_receiveHandle, receiveRingCapacity, notify, remoteRequest);
+    else
+        m_receiveThread = new KvaserReceiveThread<8>(m_receiveHandle, receiveRingCapacity, notify, remoteRequest);
+    m_receiveThread->setObjectName(QStringLiteral("KvaserCanReceive"));
+    m_receiveThread->start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void KvaserCanBackend::stopReceiveThread()
+{
+    if (m_receiveThread) {
+        m_receiveThread->stop();
+        delete m_receiveThread;
+        m_receiveThread = nullptr;
+    }
+    closeThreadHandle(m_receiveHandle);
+    m_receiveHandle = -1;
+}
+
+// Called after popping frames the receive thread read. The backend handle
+// receives the same frames, nothing else reads them.
+void KvaserCanBackend::resumeReceiveThread()
+{
+    m_receiveThread->resumeIfStalled();
+    canIoCtl(m_kvaserHandle, KVASER_IOCTL_FLUSH_RX_BUFFER, nullptr, 0);
+    const KvaserStatus result = m_receiveThread->takeReadError();
+    if (result != KvaserStatus::OK)
         setError(systemErrorString(result), ReadError);
+}
+
+void KvaserCanBackend::startBusStatistics()
+{
+    if (m_busStatisticsInterval == 0)
+        return;
+
+    if (Q_UNLIKELY(!canRequestBusStatistics || !canGetBusStatistics)) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Bus statistics are not supported by this CANLIB version.");
+        return;
+    }
+
+    m_busStatisticsRequested = false;
+    m_busStatisticsTimer->start(int(qMin(m_busStatisticsInterval, quint32(INT_MAX))));
+    sampleBusStatistics();
+}
+
+void KvaserCanBackend::stopBusStatistics()
+{
+    m_busStatisticsTimer->stop();
+    m_busStatisticsRequested = false;
+}
+
+// The device answers canRequestBusStatistics() asynchronously, so every
+// tick collects the answer to the previous request and requests the next.
+void KvaserCanBackend::sampleBusStatistics()
+{
+    if (m_kvaserHandle < 0)
+        return;
+
+    if (m_busStatisticsRequested) {
+        KvaserBusStatistics sample = {};
+        const KvaserStatus result = canGetBusStatistics(m_kvaserHandle, &sample, sizeof(sample));
+        if (result == KvaserStatus::OK) {
+            BusStatistics statistics;
+            statistics.standardDataFrames = sample.stdData;
+            statistics.standardRemoteFrames = sample.stdRemote;
+            statistics.extendedDataFrames = sample.extData;
+            statistics.extendedRemoteFrames = sample.extRemote;
+            statistics.errorFrames = sample.errFrame;
+            statistics.overruns = sample.overruns;
+            statistics.busLoad = double(sample.busLoad) / 100.0;
+            statistics.timestamp = hostMicroSeconds();
+
+            const bool changed = statistics.standardDataFrames != m_busStatistics.standardDataFrames
+                    || statistics.standardRemoteFrames != m_busStatistics.standardRemoteFrames
+                    || statistics.extendedDataFrames != m_busStatistics.extendedDataFrames
+                    || statistics.extendedRemoteFrames != m_busStatistics.extendedRemoteFrames
+                    || statistics.errorFrames != m_busStatistics.errorFrames
+                    || statistics.overruns != m_busStatistics.overruns
+                    || statistics.busLoad != m_busStatistics.busLoad
+                    || m_busStatistics.timestamp == 0;
+            m_busStatistics = statistics;
+            if (changed)
+                emit busStatisticsChanged(m_busStatistics);
+        } else {
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to get bus statistics: %ls.",
+                      qUtf16Printable(systemErrorString(result)));
+        }
+    }
+
+    const KvaserStatus result = canRequestBusStatistics(m_kvaserHandle);
+    m_busStatisticsRequested = result == KvaserStatus::OK;
+    if (Q_UNLIKELY(result != KvaserStatus::OK)) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to request bus statistics: %ls.",
+                  qUtf16Printable(systemErrorString(result)));
+    }
+}
+
+void KvaserCanBackend::setSupervisedMessages(const QList<KvaserSupervisedMessage> &messages)
+{
+    m_supervisor.setMessages(messages);
+    m_supervisionTimer->stop();
+    if (m_kvaserHandle >= 0)
+        startCycleSupervision();
+}
+
+void KvaserCanBackend::startCycleSupervision()
+{
+    if (m_supervisor.isEmpty())
+        return;
+    m_supervisor.start(hostMicroSeconds());
+    m_supervisionTimer->start(int(m_supervisor.tickInterval() / 1000));
+}
+
+void KvaserCanBackend::startCapture()
+{
+    m_capture.close();
+    if (m_captureFile.isEmpty())
+        return;
+
+    QString errorString;
+    if (!m_capture.open(m_captureFile, m_captureFileSize, qint64(m_captureRotationInterval) * 1000000,
+                        m_hostTimestamps, &errorString)) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot start capture to %ls: %ls.",
+                  qUtf16Printable(m_captureFile), qUtf16Printable(errorString));
+        setError(errorString, ConfigurationError);
+    }
+}
+
+bool KvaserCanBackend::startReplay(const QString &path, double speed)
+{
+    if (m_kvaserHandle < 0) {
+        setError(tr("Cannot replay while not connected"), OperationError);
+        return false;
+    }
+    if (!(speed > 0.0)) {
+        setError(tr("Invalid replay speed"), OperationError);
+        return false;
+    }
+
+    stopReplay();
+    QString errorString;
+    std::unique_ptr<KvaserTraceReader> reader = KvaserTraceReader::open(path, &errorString);
+    if (!reader) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Cannot replay %ls: %ls.",
+                  qUtf16Printable(path), qUtf16Printable(errorString));
+        setError(errorString, OperationError);
+        return false;
+    }
+
+    // The replay thread writes and spins on the timer of a handle of its
+    // own. It has the timer scale of the backend handle.
+    m_replayHandle = openThreadHandle(false);
+    if (m_replayHandle < 0)
+        return false;
+
+    // The CANLIB entry points are resolved in this file, so the replay
+    // thread calls them through these functions.
+    const KvaserHandle handle = m_replayHandle;
+    const qint64 microSecondsPerTick = m_timestamps.microSecondsPerTick();
+    auto write = [handle](const KvaserReplayFrame &frame) {
+        return canWrite(handle, long(frame.id), frame.payload, frame.dlc,
+                        frame.flags & (KVASER_MESSAGE_REMOTE_REQUEST | KVASER_MESSAGE_STANDARD_FRAME_FORMAT
+                                       | KVASER_MESSAGE_EXTENDED_FRAME_FORMAT | KVASER_MESSAGE_CANFD
+                                       | KVASER_MESSAGE_BIT_RATE_SWITCH));
+    };
+    auto clock = [handle, microSecondsPerTick]() {
+        qint64 ticks = 0;
+        if (kvReadTimer64 && kvReadTimer64(handle, &ticks) == KvaserStatus::OK)
+            return ticks * microSecondsPerTick;
+        return hostMicroSeconds();
+    };
+    // Posted from run() before the thread has exited. A call left over from
+    // an earlier replay must not end this one.
+    const quint64 generation = ++m_replayGeneration;
+    auto finished = [this, generation]() {
+        QMetaObject::invokeMethod(this, [this, generation]() {
+            if (generation == m_replayGeneration)
+                onReplayFinished();
+        }, Qt::QueuedConnection);
+    };
+
+    KvaserReplayThread *thread = new KvaserReplayThread(std::move(reader), speed, write, clock, finished);
+    {
+        QMutexLocker locker(&m_replayMutex);
+        m_replayThread = thread;
+    }
+    m_replayThread->setObjectName(QStringLiteral("KvaserCanReplay"));
+    m_replaying = true;
+    m_replayThread->start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void KvaserCanBackend::stopReplay()
+{
+    if (!m_replayThread)
+        return;
+    releaseReplayThread();
+    if (m_replaying) {
+        m_replaying = false;
+        emit replayFinished();
     }
 }
 
+// releaseReplayThread() waits for the thread to exit
+void KvaserCanBackend::onReplayFinished()
+{
+    if (!m_replaying || !m_replayThread)
+        return;
+    releaseReplayThread();
+    m_replaying = false;
+    emit replayFinished();
+}
+
+// Deletes the stopped thread together with its trace reader and file. The
+// statistics of a finished replay stay available until the next one.
+void KvaserCanBackend::releaseReplayThread()
+{
+    m_replayThread->stop();
+    const ReplayStatistics statistics = replayStatistics();
+    QMutexLocker locker(&m_replayMutex);
+    m_lastReplayStatistics = statistics;
+    delete m_replayThread;
+    m_replayThread = nullptr;
+    closeThreadHandle(m_replayHandle);
+    m_replayHandle = -1;
+}
+
+KvaserCanBackend::ReplayStatistics KvaserCanBackend::replayStatistics() const
+{
+    QMutexLocker locker(&m_replayMutex);
+    if (!m_replayThread)
+        return m_lastReplayStatistics;
+    ReplayStatistics statistics;
+    statistics.frames = m_replayThread->frames();
+    statistics.skippedFrames = m_replayThread->skipped();
+    statistics.transmitBufferFull = m_replayThread->transmitBufferFull();
+    statistics.writeFailures = m_replayThread->writeFailures();
+    statistics.meanError = m_replayThread->meanError();
+    const KvaserLatencyHistogram &errors = m_replayThread->errors();
+    statistics.medianAbsoluteError = double(errors.percentile(0.5)) / 1000.0;
+    statistics.p99AbsoluteError = double(errors.percentile(0.99)) / 1000.0;
+    statistics.maximumAbsoluteError = double(errors.maximum()) / 1000.0;
+    return statistics;
+}
+
+void KvaserCanBackend::superviseCycleTimes()
+{
+    // Frames already waiting in the driver count as received
+    if (m_messagesAvailable.load(std::memory_order_acquire))
+        onMessagesAvailable();
+
+    QList<KvaserMessageTimeout> timeouts;
+    m_supervisor.advance(hostMicroSeconds(), &timeouts);
+    if (!timeouts.isEmpty())
+        emit messagesTimedOut(timeouts);
+}
+
+// Reads the driver on this thread for any number of notifications since
+// the last call. Only a status different from the last one emitted counts.
+void KvaserCanBackend::onStatusChanged()
+{
+    // Cleared before reading, a notification during the read posts again
+    m_statusChanged.store(false, std::memory_order_release);
+    updateBusState();
+    const BusState state = busState();
+    if (state.status == m_reportedBusStatus)
+        return;
+    m_reportedBusStatus = state.status;
+    if (state.status == CanBusStatus::BusOff)
+        setError(tr("Bus off"), ConnectionError);
+    emit busStateChanged(state);
+}
+
 void KvaserCanBackend::onDeviceRemoved()
 {
+    channelCache()->invalidate();
     close();
 }
 
 bool KvaserCanBackend::applyConfigurationParameter(QCanBusDevice::ConfigurationKey key, const QVariant &value)
 {
-    switch (key) {
+    switch (int(key)) {
     case ReceiveOwnKey:
         return setReceiveOwnKey(value.toBool());
     case LoopbackKey:
@@ -500,6 +2257,42 @@ bool KvaserCanBackend::applyConfigurationParameter(QCanBusDevice::ConfigurationK
         return setCanFd(value.toBool());
     case DataBitRateKey:
         return setDataBitRate(value.toUInt());
+    case ReceiveThreadKey:
+        return setReceiveThread(value.toBool());
+    case ReceiveBatchSizeKey:
+        return setReceiveBatchSize(value.toUInt());
+    case ReceiveBatchTimeoutKey:
+        return setReceiveBatchTimeout(value.toUInt());
+    case HostTimestampKey:
+        return setHostTimestamps(value.toBool());
+    case LatencyTracingKey:
+        return setLatencyTracing(value.toBool());
+    case BusStatisticsIntervalKey:
+        return setBusStatisticsInterval(value.toUInt());
+    case TrafficProfilerKey:
+        return setTrafficProfiler(value.toBool());
+    case DeliveryModeKey:
+        return setDeliveryMode(value.toInt());
+    case LatestValueCapacityKey:
+        return setLatestValueCapacity(value.toUInt());
+    case ReceiveQueueLimitKey:
+        return setReceiveQueueLimit(value.toUInt());
+    case ReceiveQueueByteLimitKey:
+        return setReceiveQueueByteLimit(value.toUInt());
+    case ReceiveOverflowPolicyKey:
+        return setReceiveOverflowPolicy(value.toInt());
+    case CaptureFileKey:
+        return setCaptureFile(value.toString());
+    case CaptureFileSizeKey:
+        return setCaptureFileSize(value.toLongLong());
+    case CaptureRotationIntervalKey:
+        return setCaptureRotationInterval(value.toUInt());
+    case MergeWindowKey:
+        return setMergeWindow(value.toUInt());
+    case SamplePointKey:
+        return setSamplePoint(value.toDouble());
+    case DataSamplePointKey:
+        return setDataSamplePoint(value.toDouble());
     default:
         setError(tr("Unsupported configuration key: %1").arg(key), ConfigurationError);
         return false;
@@ -509,6 +2302,12 @@ bool KvaserCanBackend::applyConfigurationParameter(QCanBusDevice::ConfigurationK
 void KvaserCanBackend::setupChannel(const QString &interfaceName)
 {
     m_interfaceName = interfaceName;
+    m_channelNames.clear();
+    if (interfaceName.contains(QLatin1Char(','))) {
+        const QStringList names = interfaceName.split(QLatin1Char(','), Qt::SkipEmptyParts);
+        for (const QString &name : names)
+            m_channelNames.append(name.trimmed());
+    }
 }
 
 void KvaserCanBackend::setupDefaultConfigurations()
@@ -520,12 +2319,14 @@ bool KvaserCanBackend::setReceiveOwnKey(bool enable)
 {
     if (updateSettingsAllowed()) {
         quint32 receiveOwnKey = enable ? 1 : 0;
-        KvaserStatus result = canIoCtl(m_kvaserHandle, KVASER_IOCTL_RECEIVE_OWN_KEY, &receiveOwnKey, sizeof(receiveOwnKey));
-        if (result != KvaserStatus::OK) {
-            const QString errorString = systemErrorString(result);
-            setError(errorString, ConfigurationError);
-            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set receive own key: %ls", qUtf16Printable(errorString));
-            return false;
+        for (KvaserHandle handle : channelHandles()) {
+            KvaserStatus result = canIoCtl(handle, KVASER_IOCTL_RECEIVE_OWN_KEY, &receiveOwnKey, sizeof(receiveOwnKey));
+            if (result != KvaserStatus::OK) {
+                const QString errorString = systemErrorString(result);
+                setError(errorString, ConfigurationError);
+                qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set receive own key: %ls", qUtf16Printable(errorString));
+                return false;
+            }
         }
     }
     return true;
@@ -535,98 +2336,108 @@ bool KvaserCanBackend::setLoopback(bool enable)
 {
     if (updateSettingsAllowed()) {
         char transmitEcho = enable ? 1 : 0;
-        KvaserStatus result = canIoCtl(m_kvaserHandle, KVASER_IOCTL_SET_LOOPBACK, &transmitEcho, sizeof(transmitEcho));
-        if (result != KvaserStatus::OK) {
-            const QString errorString = systemErrorString(result);
-            setError(errorString, ConfigurationError);
-            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set loopback: %ls", qUtf16Printable(errorString));
-            return false;
+        for (KvaserHandle handle : channelHandles()) {
+            KvaserStatus result = canIoCtl(handle, KVASER_IOCTL_SET_LOOPBACK, &transmitEcho, sizeof(transmitEcho));
+            if (result != KvaserStatus::OK) {
+                const QString errorString = systemErrorString(result);
+                setError(errorString, ConfigurationError);
+                qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set loopback: %ls", qUtf16Printable(errorString));
+                return false;
+            }
         }
     }
     return true;
 }
 
-bool KvaserCanBackend::setBitRate(quint32 bitrate)
+static qint32 predefinedBitRate(quint32 bitrate)
 {
-    qint32 kvaserBitRate;
     switch (bitrate) {
     case 10000:
-        kvaserBitRate = KVASER_BITRATE_10K;
-        break;
+        return KVASER_BITRATE_10K;
     case 50000:
-        kvaserBitRate = KVASER_BITRATE_50K;
-        break;
+        return KVASER_BITRATE_50K;
     case 62000:
-        kvaserBitRate = KVASER_BITRATE_62K;
-        break;
+        return KVASER_BITRATE_62K;
     case 83000:
-        kvaserBitRate = KVASER_BITRATE_83K;
-        break;
+        return KVASER_BITRATE_83K;
     case 100000:
-        kvaserBitRate = KVASER_BITRATE_100K;
-        break;
+        return KVASER_BITRATE_100K;
     case 125000:
-        kvaserBitRate = KVASER_BITRATE_125K;
-        break;
+        return KVASER_BITRATE_125K;
     case 250000:
-        kvaserBitRate = KVASER_BITRATE_250K;
-        break;
+        return KVASER_BITRATE_250K;
     case 500000:
-        kvaserBitRate = KVASER_BITRATE_500K;
-        break;
+        return KVASER_BITRATE_500K;
     case 1000000:
-        kvaserBitRate = KVASER_BITRATE_1M;
-        break;
+        return KVASER_BITRATE_1M;
     default:
-        return false;
-    }
-
-    if (updateSettingsAllowed()) {
-        KvaserStatus result = canSetBusParams(m_kvaserHandle, kvaserBitRate, 0, 0, 0, 0, 0);
-        if (result != KvaserStatus::OK) {
-            const QString errorString = systemErrorString(result);
-            setError(errorString, ConfigurationError);
-            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set bitrate: %ls", qUtf16Printable(errorString));
-            return false;
-        }
+        return 0;
     }
-    return true;
 }
 
-bool KvaserCanBackend::setDataBitRate(quint32 bitrate)
+static qint32 predefinedDataBitRate(quint32 bitrate, double samplePoint)
 {
-    if (canSetBusParamsFd == nullptr)
-        return false;
-
-    qint32 kvaserDataBitRate;
+    const auto near = [samplePoint](double predefined) {
+        return samplePoint == 0.0 || qAbs(samplePoint - predefined) < 0.005;
+    };
     switch (bitrate) {
     case 500000:
-        kvaserDataBitRate = KVASER_DATA_BITRATE_500K_80P;
-        break;
+        return near(0.8) ? KVASER_DATA_BITRATE_500K_80P : 0;
     case 1000000:
-        kvaserDataBitRate = KVASER_DATA_BITRATE_1M_80P;
-        break;
+        return near(0.8) ? KVASER_DATA_BITRATE_1M_80P : 0;
     case 2000000:
-        kvaserDataBitRate = KVASER_DATA_BITRATE_2M_80P;
-        break;
+        return near(0.8) ? KVASER_DATA_BITRATE_2M_80P : 0;
     case 4000000:
-        kvaserDataBitRate = KVASER_DATA_BITRATE_4M_80P;
-        break;
+        return near(0.8) ? KVASER_DATA_BITRATE_4M_80P : 0;
     case 8000000:
-        kvaserDataBitRate = KVASER_DATA_BITRATE_8M_80P;
-        break;
+        if (near(0.8))
+            return KVASER_DATA_BITRATE_8M_80P;
+        if (qAbs(samplePoint - 0.7) < 0.005)
+            return KVASER_DATA_BITRATE_8M_70P;
+        if (qAbs(samplePoint - 0.6) < 0.005)
+            return KVASER_DATA_BITRATE_8M_60P;
+        return 0;
     default:
+        return 0;
+    }
+}
+
+static KvaserBusParamsTq busParamsTq(const KvaserBitTiming &timing)
+{
+    KvaserBusParamsTq params;
+    params.tq = int(timing.quanta);
+    params.phase1 = int(timing.phaseSegment1);
+    params.phase2 = int(timing.phaseSegment2);
+    params.sjw = int(timing.syncJumpWidth);
+    params.prop = int(timing.propagationSegment);
+    params.prescaler = int(timing.prescaler);
+    return params;
+}
+
+bool KvaserCanBackend::setBitRate(quint32 bitrate)
+{
+    if (bitrate == 0)
+        return false;
+
+    const quint32 previous = m_bitRate;
+    m_bitRate = bitrate;
+    if (!applyBusParameters()) {
+        m_bitRate = previous;
         return false;
     }
+    return true;
+}
 
-    if (updateSettingsAllowed()) {
-        KvaserStatus result = canSetBusParamsFd(m_kvaserHandle, kvaserDataBitRate, 0, 0, 0);
-        if (result != KvaserStatus::OK) {
-            const QString errorString = systemErrorString(result);
-            setError(errorString, ConfigurationError);
-            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set data bitrate: %ls", qUtf16Printable(errorString));
-            return false;
-        }
+bool KvaserCanBackend::setDataBitRate(quint32 bitrate)
+{
+    if (canSetBusParamsFd == nullptr || bitrate == 0)
+        return false;
+
+    const quint32 previous = m_dataBitRate;
+    m_dataBitRate = bitrate;
+    if (!applyBusParameters()) {
+        m_dataBitRate = previous;
+        return false;
     }
     return true;
 }
@@ -637,138 +2448,377 @@ bool KvaserCanBackend::setCanFd(bool enable)
     return true;
 }
 
-bool KvaserCanBackend::setFilters(const QList<Filter> &filterList)
+bool KvaserCanBackend::setSamplePoint(double samplePoint)
 {
-    bool isStandardFrameFilterSet = false;
-    bool isExtendedFrameFilterSet = false;
+    if (samplePoint != 0.0 && !(samplePoint > 0.0 && samplePoint < 1.0))
+        return false;
 
-    if (filterList.isEmpty()) {
-        if (updateSettingsAllowed()) {
-            // Permit all standard frames
-            KvaserStatus result = canSetAcceptanceFilter(m_kvaserHandle, 0, 0, KVASER_FILTER_STANDARD_FRAME_FORMAT);
-            if (result != KvaserStatus::OK) {
-                const QString errorString = systemErrorString(result);
-                setError(errorString, ConfigurationError);
-                qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (all standard): %ls",
-                          qUtf16Printable(errorString));
-                return false;
-            }
-            // Permit all extended frames
-            result = canSetAcceptanceFilter(m_kvaserHandle, 0, 0, KVASER_FILTER_EXTENDED_FRAME_FORMAT);
+    const double previous = m_samplePoint;
+    m_samplePoint = samplePoint;
+    if (!applyBusParameters()) {
+        m_samplePoint = previous;
+        return false;
+    }
+    return true;
+}
+
+bool KvaserCanBackend::setDataSamplePoint(double samplePoint)
+{
+    if (samplePoint != 0.0 && !(samplePoint > 0.0 && samplePoint < 1.0))
+        return false;
+
+    const double previous = m_dataSamplePoint;
+    m_dataSamplePoint = samplePoint;
+    if (!applyBusParameters()) {
+        m_dataSamplePoint = previous;
+        return false;
+    }
+    return true;
+}
+
+// Calculates the timing of the configured bit rates and sample points and
+// sets it on every channel while the settings can be updated. Standard bit
+// rates without a sample point keep the predefined CANLIB constants, which
+// is all older drivers without the time quanta functions understand.
+bool KvaserCanBackend::applyBusParameters()
+{
+    if (m_bitRate == 0)
+        return true;
+
+    const bool canFd = m_kvaserHandle >= 0 ? m_channelIsCanFd : m_canFd;
+    const bool dataPhase = canFd && m_dataBitRate != 0;
+    // kvBusParamsTq can only describe both phases at once
+    const bool useTq = dataPhase ? canSetBusParamsFdTq != nullptr : (!canFd && canSetBusParamsTq != nullptr);
+
+    qint32 predefinedNominal = m_samplePoint == 0.0 ? predefinedBitRate(m_bitRate) : 0;
+    qint32 predefinedData = dataPhase ? predefinedDataBitRate(m_dataBitRate, m_dataSamplePoint) : 0;
+    if (dataPhase && useTq && (predefinedNominal == 0 || predefinedData == 0)) {
+        predefinedNominal = 0;
+        predefinedData = 0;
+    }
+
+    const quint32 clockFrequency = m_clockFrequency != 0
+            ? m_clockFrequency : KvaserBitTimingCalculator::defaultClockFrequency;
+    KvaserBitTiming nominal;
+    if (predefinedNominal == 0) {
+        const double samplePoint = m_samplePoint != 0.0 ? m_samplePoint : (canFd ? 0.8 : 0.875);
+        const KvaserBitTimingLimits &limits = (canFd || useTq)
+                ? KvaserBitTimingCalculator::arbitrationLimits : KvaserBitTimingCalculator::classicLimits;
+        if (!KvaserBitTimingCalculator::calculate(clockFrequency, m_bitRate, samplePoint, limits, &nominal)) {
+            const QString errorString = tr("No bit timing for %1 bit/s with sample point %2")
+                    .arg(m_bitRate).arg(samplePoint);
+            setError(errorString, ConfigurationError);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set bitrate: %ls", qUtf16Printable(errorString));
+            return false;
+        }
+    }
+    KvaserBitTiming data;
+    if (dataPhase && predefinedData == 0) {
+        const double samplePoint = m_dataSamplePoint != 0.0 ? m_dataSamplePoint : 0.8;
+        if (!KvaserBitTimingCalculator::calculate(clockFrequency, m_dataBitRate, samplePoint,
+                                                  KvaserBitTimingCalculator::dataLimits, &data)) {
+            const QString errorString = tr("No bit timing for %1 bit/s with sample point %2")
+                    .arg(m_dataBitRate).arg(samplePoint);
+            setError(errorString, ConfigurationError);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set data bitrate: %ls", qUtf16Printable(errorString));
+            return false;
+        }
+    }
+
+    if (updateSettingsAllowed()) {
+        for (KvaserHandle handle : channelHandles()) {
+            KvaserStatus result = setBusParameters(handle, dataPhase, predefinedNominal, nominal, predefinedData, data);
             if (result != KvaserStatus::OK) {
                 const QString errorString = systemErrorString(result);
                 setError(errorString, ConfigurationError);
-                qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (all extended): %ls",
-                          qUtf16Printable(errorString));
+                qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set bitrate: %ls", qUtf16Printable(errorString));
                 return false;
             }
         }
+    }
+    m_nominalTiming = nominal;
+    m_dataTiming = data;
+    return true;
+}
+
+// A predefined bit rate of 0 means the calculated timing is set
+KvaserStatus KvaserCanBackend::setBusParameters(KvaserHandle handle, bool dataPhase,
+                                                qint32 predefinedNominal, const KvaserBitTiming &nominal,
+                                                qint32 predefinedData, const KvaserBitTiming &data)
+{
+    if (!dataPhase) {
+        if (predefinedNominal != 0)
+            return canSetBusParams(handle, predefinedNominal, 0, 0, 0, 0, 0);
+        if (canSetBusParamsTq != nullptr && !m_channelIsCanFd)
+            return canSetBusParamsTq(handle, busParamsTq(nominal));
+        return canSetBusParams(handle, long(nominal.requestedBitRate), nominal.timeSegment1(),
+                               nominal.timeSegment2(), nominal.syncJumpWidth, 1, 0);
+    }
+
+    if (predefinedNominal == 0 && predefinedData == 0 && canSetBusParamsFdTq != nullptr)
+        return canSetBusParamsFdTq(handle, busParamsTq(nominal), busParamsTq(data));
+
+    KvaserStatus result;
+    if (predefinedNominal != 0) {
+        result = canSetBusParams(handle, predefinedNominal, 0, 0, 0, 0, 0);
     } else {
-        for (const Filter& filter : filterList) {
-            if (filter.type != QCanBusFrame::DataFrame) {
-                setError(tr("Only DataFrame filters are supported"), ConfigurationError);
-                return false;
-            }
+        result = canSetBusParams(handle, long(nominal.requestedBitRate), nominal.timeSegment1(),
+                                 nominal.timeSegment2(), nominal.syncJumpWidth, 1, 0);
+    }
+    if (result != KvaserStatus::OK)
+        return result;
+    if (predefinedData != 0)
+        return canSetBusParamsFd(handle, predefinedData, 0, 0, 0);
+    return canSetBusParamsFd(handle, long(data.requestedBitRate), data.timeSegment1(),
+                             data.timeSegment2(), data.syncJumpWidth);
+}
 
-            switch (filter.format) {
-            case Filter::MatchBaseFormat:
-            {
-                if (isStandardFrameFilterSet) {
-                    setError(tr("Hardware supports only one standard frame and one extended frame filter"), ConfigurationError);
-                    return false;
-                }
-                isStandardFrameFilterSet = true;
-                if (updateSettingsAllowed()) {
-                    KvaserStatus result = canSetAcceptanceFilter(m_kvaserHandle, filter.frameId, filter.frameIdMask,
-                                                                 KVASER_FILTER_STANDARD_FRAME_FORMAT);
-                    if (result != KvaserStatus::OK) {
-                        const QString errorString = systemErrorString(result);
-                        setError(errorString, ConfigurationError);
-                        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (standard only): %ls",
-                                  qUtf16Printable(errorString));
-                        return false;
-                    }
-                }
-                break;
-            }
-            case Filter::MatchExtendedFormat:
-            {
-                if (isExtendedFrameFilterSet) {
-                    setError(tr("Hardware supports only one standard frame and one extended frame filter"), ConfigurationError);
-                    return false;
-                }
-                isExtendedFrameFilterSet = true;
-                if (updateSettingsAllowed()) {
-                    KvaserStatus result = canSetAcceptanceFilter(m_kvaserHandle, filter.frameId, filter.frameIdMask,
-                                                                 KVASER_FILTER_EXTENDED_FRAME_FORMAT);
-                    if (result != KvaserStatus::OK) {
-                        const QString errorString = systemErrorString(result);
-                        setError(errorString, ConfigurationError);
-                        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (extended only): %ls",
-                                  qUtf16Printable(errorString));
-                        return false;
-                    }
-                }
-                break;
-            }
-            case Filter::MatchBaseAndExtendedFormat:
-            {
-                if (isExtendedFrameFilterSet || isStandardFrameFilterSet) {
-                    setError(tr("Hardware supports only one standard frame and one extended frame filter"), ConfigurationError);
-                    return false;
-                }
-                isStandardFrameFilterSet = true;
-                isExtendedFrameFilterSet = true;
-                if (updateSettingsAllowed()) {
-                    KvaserStatus result = canSetAcceptanceFilter(m_kvaserHandle, filter.frameId, filter.frameIdMask,
-                                                                 KVASER_FILTER_STANDARD_FRAME_FORMAT);
-                    if (result != KvaserStatus::OK) {
-                        const QString errorString = systemErrorString(result);
-                        setError(errorString, ConfigurationError);
-                        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (standard): %ls",
-                                  qUtf16Printable(errorString));
-                        return false;
-                    }
-                    result = canSetAcceptanceFilter(m_kvaserHandle, filter.frameId, filter.frameIdMask,
-                                                    KVASER_FILTER_EXTENDED_FRAME_FORMAT);
-                    if (result != KvaserStatus::OK) {
-                        const QString errorString = systemErrorString(result);
-                        setError(errorString, ConfigurationError);
-                        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set filters (extended): %ls",
-                                  qUtf16Printable(errorString));
-                        return false;
-                    }
-                }
-                break;
-            }
-            }
-        }
+QString KvaserCanBackend::bitTimingReport() const
+{
+    QString report = QStringLiteral("Nominal: ");
+    if (m_nominalTiming.isValid())
+        report += KvaserBitTimingCalculator::format(m_nominalTiming);
+    else
+        report += QStringLiteral("%1 bit/s, predefined CANLIB timing").arg(m_bitRate);
+
+    const bool canFd = m_kvaserHandle >= 0 ? m_channelIsCanFd : m_canFd;
+    if (canFd && m_dataBitRate != 0) {
+        report += QStringLiteral("\nData: ");
+        if (m_dataTiming.isValid())
+            report += KvaserBitTimingCalculator::format(m_dataTiming);
+        else
+            report += QStringLiteral("%1 bit/s, predefined CANLIB timing").arg(m_dataBitRate);
     }
+    return report;
+}
+
+bool KvaserCanBackend::setReceiveThread(bool enable)
+{
+    m_useReceiveThread = enable;
     return true;
 }
 
-bool KvaserCanBackend::setDriverMode(KvaserDriverMode mode)
+bool KvaserCanBackend::setReceiveBatchSize(quint32 frames)
+{
+    m_receiveBatchSize = frames;
+    return true;
+}
+
+bool KvaserCanBackend::setReceiveBatchTimeout(quint32 microseconds)
+{
+    m_receiveBatchTimeout = microseconds;
+    return true;
+}
+
+bool KvaserCanBackend::setHostTimestamps(bool enable)
+{
+    m_hostTimestamps = enable;
+    return true;
+}
+
+bool KvaserCanBackend::setLatencyTracing(bool enable)
+{
+    m_latencyTracing.store(enable, std::memory_order_relaxed);
+    return true;
+}
+
+bool KvaserCanBackend::setBusStatisticsInterval(quint32 milliseconds)
+{
+    m_busStatisticsInterval = milliseconds;
+    if (m_kvaserHandle >= 0) {
+        stopBusStatistics();
+        startBusStatistics();
+    }
+    return true;
+}
+
+bool KvaserCanBackend::setTrafficProfiler(bool enable)
+{
+    m_profileTraffic = enable;
+    return true;
+}
+
+bool KvaserCanBackend::setDeliveryMode(int mode)
+{
+    if (mode < QueuedDelivery || mode > DirectDelivery)
+        return false;
+    m_deliveryMode = DeliveryMode(mode);
+    return true;
+}
+
+bool KvaserCanBackend::setLatestValueCapacity(quint32 identifiers)
+{
+    m_latestValueCapacity = identifiers;
+    return true;
+}
+
+bool KvaserCanBackend::setReceiveQueueLimit(quint32 frames)
+{
+    m_receiveQueueLimit = frames;
+    return true;
+}
+
+bool KvaserCanBackend::setReceiveQueueByteLimit(quint32 bytes)
+{
+    m_receiveQueueByteLimit = bytes;
+    return true;
+}
+
+bool KvaserCanBackend::setReceiveOverflowPolicy(int policy)
+{
+    if (policy < DropOldestFrames || policy > StopDraining)
+        return false;
+    m_overflowPolicy = OverflowPolicy(policy);
+    return true;
+}
+
+bool KvaserCanBackend::setCaptureFile(const QString &path)
+{
+    m_captureFile = path;
+    if (m_kvaserHandle >= 0)
+        startCapture();
+    return true;
+}
+
+bool KvaserCanBackend::setCaptureFileSize(qint64 bytes)
+{
+    if (bytes <= 0)
+        return false;
+    m_captureFileSize = bytes;
+    return true;
+}
+
+bool KvaserCanBackend::setCaptureRotationInterval(quint32 seconds)
+{
+    m_captureRotationInterval = seconds;
+    return true;
+}
+
+bool KvaserCanBackend::setMergeWindow(quint32 microseconds)
+{
+    m_mergeWindow = microseconds;
+    return true;
+}
+
+// Returns the resulting timer resolution in microseconds per tick
+quint32 KvaserCanBackend::setTimerScale(KvaserHandle handle)
 {
-    KvaserStatus result = canSetBusOutputControl(m_kvaserHandle, quint32(mode));
+    quint32 microSecondsPerTick = 1;
+    KvaserStatus result = canIoCtl(handle, KVASER_IOCTL_SET_TIMER_SCALE, &microSecondsPerTick, sizeof(microSecondsPerTick));
     if (result != KvaserStatus::OK) {
         const QString errorString = systemErrorString(result);
-        setError(errorString, ConfigurationError);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set driver mode: %ls",
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set microsecond timer resolution: %ls",
                   qUtf16Printable(errorString));
-        return false;
+        // The driver default is one millisecond
+        return 1000;
+    }
+    return microSecondsPerTick;
+}
+
+bool KvaserCanBackend::setFilters(const QList<Filter> &filterList)
+{
+    for (const Filter &filter : filterList) {
+        if (filter.type != QCanBusFrame::DataFrame
+                && filter.type != QCanBusFrame::RemoteRequestFrame
+                && filter.type != QCanBusFrame::InvalidFrame) {
+            setError(tr("Only data and remote request frame filters are supported"), ConfigurationError);
+            return false;
+        }
+    }
+
+    // Every filter list is matched exactly in software while draining. The
+    // hardware filter is programmed with the tightest code/mask covering
+    // the list, to save driver and bus interface traffic. The matcher only
+    // replaces the current one once the hardware took the new filter.
+    KvaserFilterMatcher filter;
+    filter.setFilters(filterList);
+
+    quint32 standardCode = 0;
+    quint32 standardMask = 0;
+    KvaserFilterMatcher::coveringFilter(filterList, false, &standardCode, &standardMask);
+    quint32 extendedCode = 0;
+    quint32 extendedMask = 0;
+    KvaserFilterMatcher::coveringFilter(filterList, true, &extendedCode, &extendedMask);
+
+    if (updateSettingsAllowed()) {
+        if (!setAcceptanceFilter(standardCode, standardMask, KVASER_FILTER_STANDARD_FRAME_FORMAT)
+                || !setAcceptanceFilter(extendedCode, extendedMask, KVASER_FILTER_EXTENDED_FRAME_FORMAT)) {
+            restoreAcceptanceFilters();
+            return false;
+        }
+    }
+
+    m_filter = std::move(filter);
+    m_standardFilterCode = standardCode;
+    m_standardFilterMask = standardMask;
+    m_extendedFilterCode = extendedCode;
+    m_extendedFilterMask = extendedMask;
+    m_standardFilterPassRatio = KvaserFilterMatcher::passRatio(standardMask, false);
+    m_extendedFilterPassRatio = KvaserFilterMatcher::passRatio(extendedMask, true);
+    return true;
+}
+
+bool KvaserCanBackend::setAcceptanceFilter(quint32 code, quint32 mask, int format)
+{
+    for (KvaserHandle handle : channelHandles()) {
+        KvaserStatus result = canSetAcceptanceFilter(handle, code, mask, format);
+        if (result != KvaserStatus::OK) {
+            const QString errorString = systemErrorString(result);
+            setError(errorString, ConfigurationError);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set %s filter: %ls",
+                      format == KVASER_FILTER_STANDARD_FRAME_FORMAT ? "standard" : "extended",
+                      qUtf16Printable(errorString));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Puts the covering filter of the current filter list back on every
+// channel, after a new one was only programmed on some channels or for
+// one frame format
+void KvaserCanBackend::restoreAcceptanceFilters()
+{
+    for (KvaserHandle handle : channelHandles()) {
+        KvaserStatus result = canSetAcceptanceFilter(handle, m_standardFilterCode, m_standardFilterMask,
+                                                     KVASER_FILTER_STANDARD_FRAME_FORMAT);
+        if (result == KvaserStatus::OK) {
+            result = canSetAcceptanceFilter(handle, m_extendedFilterCode, m_extendedFilterMask,
+                                            KVASER_FILTER_EXTENDED_FRAME_FORMAT);
+        }
+        if (result != KvaserStatus::OK) {
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to restore the previous filter: %ls",
+                      qUtf16Printable(systemErrorString(result)));
+        }
+    }
+}
+
+bool KvaserCanBackend::setDriverMode(KvaserDriverMode mode)
+{
+    for (KvaserHandle handle : channelHandles()) {
+        KvaserStatus result = canSetBusOutputControl(handle, quint32(mode));
+        if (result != KvaserStatus::OK) {
+            const QString errorString = systemErrorString(result);
+            setError(errorString, ConfigurationError);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set driver mode: %ls",
+                      qUtf16Printable(errorString));
+            return false;
+        }
     }
     return true;
 }
 
 bool KvaserCanBackend::setBusOn()
 {
-    KvaserStatus result = canBusOn(m_kvaserHandle);
-    if (result != KvaserStatus::OK) {
-        const QString errorString = systemErrorString(result);
-        setError(errorString, ConfigurationError);
-        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set bus on: %ls",
-                  qUtf16Printable(errorString));
-        return false;
+    for (KvaserHandle handle : channelHandles()) {
+        KvaserStatus result = canBusOn(handle);
+        if (result != KvaserStatus::OK) {
+            const QString errorString = systemErrorString(result);
+            setError(errorString, ConfigurationError);
+            qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Failed to set bus on: %ls",
+                      qUtf16Printable(errorString));
+            return false;
+        }
     }
     return true;
 }
@@ -39,14 +39,32 @@
 #ifndef KVASERCANBACKEND_H
 #define KVASERCANBACKEND_H
 
-#include "kvasercan_symbols_p.h"
+#include "kvasercanbackend_p.h"
+#include "kvasercancache_p.h"
+#include "kvasercancapture_p.h"
+#include "kvasercanfilter_p.h"
+#include "kvasercanperiodic_p.h"
+#include "kvasercanprofiler_p.h"
+#include "kvasercanreplay_p.h"
+#include "kvasercanresponder_p.h"
+#include "kvasercansupervisor_p.h"
+#include "kvasercantiming_p.h"
 
 #include <QtSerialBus/qcanbusframe.h>
 #include <QtSerialBus/qcanbusdevice.h>
 #include <QtSerialBus/qcanbusdeviceinfo.h>
 
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qlist.h>
+#include <QtCore/qmetatype.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qstringlist.h>
 #include <QtCore/qvariant.h>
+#include <QtCore/qvarlengtharray.h>
+
+#include <atomic>
+#include <vector>
 
 QT_BEGIN_NAMESPACE
 
@@ -55,34 +73,431 @@ class KvaserCanBackend : public QCanBusDevice
 {
     Q_OBJECT
     Q_DISABLE_COPY(KvaserCanBackend)
+    // Fraction of the 11 and 29 bit identifier space that passes the
+    // hardware acceptance filter derived from RawFilterKey.
+    Q_PROPERTY(double standardFilterPassRatio READ standardFilterPassRatio)
+    Q_PROPERTY(double extendedFilterPassRatio READ extendedFilterPassRatio)
 
 public:
+    // Backend specific configuration keys, applied when the device is opened.
+    // ReceiveThreadKey (bool): drain canRead on a backend-owned thread and
+    // only hand the received frames over to the Qt thread. The thread reads
+    // from a second handle on the channel, ReceiveOwnKey applies to it when
+    // the device is opened.
+    static constexpr ConfigurationKey ReceiveThreadKey = ConfigurationKey(UserKey + 0);
+    // ReceiveBatchSizeKey (uint) and ReceiveBatchTimeoutKey (uint, microseconds):
+    // received frames are delivered once the batch holds this many frames or
+    // the oldest frame has waited this long, whichever comes first. Without
+    // both every drain is delivered immediately, a size without a timeout
+    // delivers after at most 10 ms. The precise Qt timer enforcing the timeout counts whole
+    // milliseconds, so a batch may be delivered up to a millisecond before
+    // the timeout, never after it, and timeouts below a millisecond deliver
+    // on the next pass of the event loop.
+    static constexpr ConfigurationKey ReceiveBatchSizeKey = ConfigurationKey(UserKey + 1);
+    static constexpr ConfigurationKey ReceiveBatchTimeoutKey = ConfigurationKey(UserKey + 2);
+    // HostTimestampKey (bool): map the microsecond device timestamps onto the
+    // host monotonic clock, so that frames of different channels compare.
+    static constexpr ConfigurationKey HostTimestampKey = ConfigurationKey(UserKey + 3);
+    // LatencyTracingKey (bool): stamp every receive batch when the CANLIB
+    // callback fires, when draining starts, when reading is complete and when
+    // the frames are enqueued, see latencyReport().
+    static constexpr ConfigurationKey LatencyTracingKey = ConfigurationKey(UserKey + 4);
+    // BusStatisticsIntervalKey (uint, milliseconds): sample the bus statistics
+    // of the device at this interval while connected, 0 disables sampling.
+    static constexpr ConfigurationKey BusStatisticsIntervalKey = ConfigurationKey(UserKey + 5);
+    // TrafficProfilerKey (bool): count frames, bytes, bus time and period
+    // of every received identifier before filtering, see trafficProfile().
+    static constexpr ConfigurationKey TrafficProfilerKey = ConfigurationKey(UserKey + 6);
+    // DeliveryModeKey (DeliveryMode): QueuedDelivery hands every frame to
+    // readFrame(), CachedDelivery additionally keeps the newest frame of every
+    // identifier for latestFrame() and latestFrames(), ConflatedDelivery only
+    // keeps the newest frames, error frames are still queued. DirectDelivery
+    // leaves the messages in the driver until readFrames() is called and
+    // only emits framesReceived().
+    // LatestValueCapacityKey (uint): number of distinct 29 bit identifiers
+    // the latest value cache holds, 11 bit identifiers always fit.
+    static constexpr ConfigurationKey DeliveryModeKey = ConfigurationKey(UserKey + 7);
+    static constexpr ConfigurationKey LatestValueCapacityKey = ConfigurationKey(UserKey + 8);
+    // ReceiveQueueLimitKey (uint, frames) and ReceiveQueueByteLimitKey (uint,
+    // bytes): bound the frames waiting for readFrame(), 0 means unbounded.
+    // The byte limit is converted into frames using the estimated heap size
+    // of a QCanBusFrame of the channel. ReceiveOverflowPolicyKey
+    // (OverflowPolicy) selects what happens when the queue is full.
+    static constexpr ConfigurationKey ReceiveQueueLimitKey = ConfigurationKey(UserKey + 9);
+    static constexpr ConfigurationKey ReceiveQueueByteLimitKey = ConfigurationKey(UserKey + 10);
+    static constexpr ConfigurationKey ReceiveOverflowPolicyKey = ConfigurationKey(UserKey + 11);
+    // CaptureFileKey (QString): record every received message, before
+    // filtering, to memory mapped capture files named after this path, see
+    // kvasercancapture_p.h for the format. An empty path stops capturing.
+    // CaptureFileSizeKey (qint64, bytes) is the size files are preallocated
+    // to and rotated at, 256 MiB by default. CaptureRotationIntervalKey
+    // (uint, seconds) also starts a new file after that time, 0 never does.
+    static constexpr ConfigurationKey CaptureFileKey = ConfigurationKey(UserKey + 12);
+    static constexpr ConfigurationKey CaptureFileSizeKey = ConfigurationKey(UserKey + 13);
+    static constexpr ConfigurationKey CaptureRotationIntervalKey = ConfigurationKey(UserKey + 14);
+    // MergeWindowKey (uint, microseconds): an aggregated device holds every
+    // received frame back until it is this old, so that frames of other
+    // channels still on their way through the driver are merged before it.
+    // 0 only orders the frames available at each drain.
+    static constexpr ConfigurationKey MergeWindowKey = ConfigurationKey(UserKey + 15);
+    // SamplePointKey and DataSamplePointKey (double, fraction of the bit
+    // like 0.875): sample point of the arbitration and the CAN FD data
+    // phase. 0 keeps the predefined CANLIB timing of standard bit rates and
+    // defaults to 87.5 percent on classic and 80 percent on CAN FD channels
+    // otherwise. BitRateKey and DataBitRateKey accept any bit rate the
+    // controller clock can be divided into, see nominalBitTiming().
+    static constexpr ConfigurationKey SamplePointKey = ConfigurationKey(UserKey + 16);
+    static constexpr ConfigurationKey DataSamplePointKey = ConfigurationKey(UserKey + 17);
+
+    enum DeliveryMode {
+        QueuedDelivery,
+        CachedDelivery,
+        ConflatedDelivery,
+        DirectDelivery
+    };
+
+    // StopDraining leaves the messages in the driver queue until the
+    // application made room, the driver then reports overruns instead.
+    enum OverflowPolicy {
+        DropOldestFrames,
+        DropNewestFrames,
+        StopDraining
+    };
+
+    enum LatencyStage {
+        CallbackToDrainStage,
+        DrainToReadCompleteStage,
+        ReadCompleteToEnqueueStage,
+        CallbackToEnqueueStage,
+        LatencyStageCount
+    };
+
+    // Decoded form of the error frames received from this backend. Their
+    // payload follows the SocketCAN error frame layout.
+    struct ErrorFrameInfo
+    {
+        QCanBusFrame::FrameErrors errors;
+        quint8 controllerStatus = 0;
+        quint8 protocolType = 0;
+        quint8 protocolLocation = 0;
+        quint8 txErrorCounter = 0;
+        quint8 rxErrorCounter = 0;
+        bool hardwareOverrun = false;
+        bool softwareOverrun = false;
+    };
+
+    // Snapshot of the runtime statistics. drainBatchSizes[0] counts drains
+    // that found no message, drainBatchSizes[n] drains of 2^(n-1) up to
+    // 2^n - 1 messages, the last bucket also everything above.
+    static constexpr int DrainBatchBuckets = 16;
+    struct Statistics
+    {
+        quint64 receivedFrames = 0;
+        quint64 receivedBytes = 0;
+        quint64 filteredFrames = 0;
+        quint64 errorFrames = 0;
+        quint64 hardwareOverruns = 0;
+        quint64 softwareOverruns = 0;
+        quint64 writtenFrames = 0;
+        quint64 writtenBytes = 0;
+        quint64 writeFailures = 0;
+        quint64 transmitBufferFull = 0;
+        quint64 drains = 0;
+        quint64 drainBatchSizes[DrainBatchBuckets] = {};
+        // Frames of 29 bit identifiers beyond LatestValueCapacityKey
+        quint64 cacheOverflows = 0;
+        // Frames dropped because the receive queue was full
+        quint64 droppedFrames = 0;
+        // Remote requests answered by the backend, not by the device
+        quint64 autoResponses = 0;
+        quint64 autoResponseFailures = 0;
+    };
+
+    // Last bus statistics sampled from the device. The frame counts are
+    // counted by the device since bus on, busLoad is in percent.
+    struct BusStatistics
+    {
+        quint64 standardDataFrames = 0;
+        quint64 standardRemoteFrames = 0;
+        quint64 extendedDataFrames = 0;
+        quint64 extendedRemoteFrames = 0;
+        quint64 errorFrames = 0;
+        quint64 overruns = 0;
+        double busLoad = 0.0;
+        // Host monotonic time of the sample in microseconds, 0 if none yet
+        qint64 timestamp = 0;
+    };
+
+    // Bus status of the device as of the last status notification of the
+    // driver. The pending, error and overrun flags are not notified on their
+    // own and may be stale. overruns counts up to 32767.
+    struct BusState
+    {
+        CanBusStatus status = CanBusStatus::Unknown;
+        quint32 transmitErrorCounter = 0;
+        quint32 receiveErrorCounter = 0;
+        quint32 overruns = 0;
+        bool transmitPending = false;
+        bool receivePending = false;
+        bool transmitError = false;
+        bool receiveError = false;
+        bool hardwareOverrun = false;
+        bool softwareOverrun = false;
+    };
+
+    // Compact received frame for readFrames(). length is the number of
+    // payload bytes, timestamp is in microseconds like QCanBusFrame's and
+    // channel identifies the member channel of the device.
+    enum FrameRecordFlag : quint16 {
+        RecordExtendedFrameFormat = 0x01,
+        RecordFlexibleDataRateFormat = 0x02,
+        RecordBitrateSwitch = 0x04,
+        RecordErrorStateIndicator = 0x08,
+        RecordRemoteRequest = 0x10,
+        // The payload follows the error frame layout of decodeErrorFrame()
+        RecordErrorFrame = 0x20,
+        // A CAN FD payload did not fit into a classic record
+        RecordTruncated = 0x40
+    };
+
+    template <int MaxPayloadSize>
+    struct FrameRecord
+    {
+        quint32 frameId;
+        quint16 flags;
+        quint8 length;
+        quint8 channel;
+        qint64 timestamp;
+        char payload[MaxPayloadSize];
+    };
+    using ClassicFrameRecord = FrameRecord<8>;
+    using FdFrameRecord = FrameRecord<64>;
+
+    // Timing of the current or last replay. Errors are the time at which
+    // a frame was handed to the driver minus the time it was due, on the
+    // device timer, in microseconds.
+    struct ReplayStatistics
+    {
+        quint64 frames = 0;
+        quint64 skippedFrames = 0;
+        quint64 transmitBufferFull = 0;
+        quint64 writeFailures = 0;
+        double meanError = 0.0;
+        double medianAbsoluteError = 0.0;
+        double p99AbsoluteError = 0.0;
+        double maximumAbsoluteError = 0.0;
+    };
+
+    // Timing of the periodic frames transmitted by the scheduler thread,
+    // object buffers of the device are not measured. Jitter is the time a
+    // frame was handed to the driver minus the time it was due, in
+    // microseconds on the host clock.
+    struct PeriodicStatistics
+    {
+        quint64 frames = 0;
+        quint64 transmitBufferFull = 0;
+        quint64 writeFailures = 0;
+        quint64 missedPeriods = 0;
+        double medianJitter = 0.0;
+        double p99Jitter = 0.0;
+        double maximumJitter = 0.0;
+    };
+
     explicit KvaserCanBackend(const QString &name, QObject *parent = nullptr);
     ~KvaserCanBackend();
     bool open() override;
     void close() override;
     void setConfigurationParameter(ConfigurationKey key, const QVariant &value) override;
     bool writeFrame(const QCanBusFrame &frame) override;
+    // Also counts the frame taken from the queue that the driver had no
+    // room for. QCanBusDevice::framesToWrite() is not virtual, so
+    // waitForFramesWritten() is overridden to wait on this one.
+    qint64 framesToWrite() const { return QCanBusDevice::framesToWrite() + (m_hasHeldFrame ? 1 : 0); }
+    bool waitForFramesWritten(int msecs) override;
     QString interpretErrorFrame(const QCanBusFrame &errorFrame) override;
+    static ErrorFrameInfo decodeErrorFrame(const QCanBusFrame &errorFrame);
     static bool canCreate(QString *errorReason);
     static QList<QCanBusDeviceInfo> interfaces();
+    // Never calls into the driver, see busState()
     QCanBusDevice::CanBusStatus busStatus() override;
+    // Safe to call from any thread
+    BusState busState() const;
     void resetController() override;
+    // Latency percentiles of every traced stage, safe to call from any thread
+    QString latencyReport() const;
+    void resetLatencyHistograms();
+    // Safe to call from any thread
+    Statistics statistics() const;
+    // Must be called from the thread the backend lives in
+    void resetStatistics();
+    // Must be called from the thread the backend lives in, never calls
+    // into the driver
+    BusStatistics busStatistics() const { return m_busStatistics; }
+    // Must be called from the thread the backend lives in. The profile is
+    // sorted by descending bus time.
+    QList<KvaserTrafficEntry> trafficProfile() const;
+    QString trafficReport() const;
+    void resetTrafficProfile();
+    // Reads up to maxRecords received frames straight from the driver and
+    // returns how many were stored, -1 if the device is not connected. Meant
+    // for DirectDelivery, must be called from the thread the backend lives in.
+    qint64 readFrames(ClassicFrameRecord *records, qint64 maxRecords);
+    qint64 readFrames(FdFrameRecord *records, qint64 maxRecords);
+    // Transmits a capture file of this plugin, a candump log or a Vector ASC
+    // file with its original timing divided by speed, on a backend-owned
+    // thread. Works with virtual channels like with real ones.
+    bool startReplay(const QString &path, double speed = 1.0);
+    void stopReplay();
+    bool isReplaying() const { return m_replaying; }
+    // Safe to call from any thread
+    ReplayStatistics replayStatistics() const;
+    // Transmits the data or remote request frame every period until
+    // stopPeriodicFrame() or close(). A periodic object buffer of the device
+    // sends it if the device has one left, a backend-owned scheduler thread
+    // otherwise. Returns an identifier for the other functions, 0 on error.
+    int startPeriodicFrame(const QCanBusFrame &frame, quint32 periodMicroSeconds);
+    // Replaces the payload from the next transmission on. The bytes are
+    // copied straight into the object buffer or the scheduler's message,
+    // a transmission never mixes old and new bytes.
+    bool updatePeriodicPayload(int periodicId, const char *payload, int size);
+    bool stopPeriodicFrame(int periodicId);
+    void stopPeriodicFrames();
+    bool isPeriodicInHardware(int periodicId) const;
+    // Safe to call from any thread
+    PeriodicStatistics periodicStatistics() const;
+    // Answers every remote request frame for the identifier and format of
+    // the data frame response with it, until removeAutoResponse() or
+    // close(). An auto response object buffer of the device answers if one
+    // is left, the receive path of the backend otherwise, before the remote
+    // request reaches Qt. Only remote requests passing the acceptance filter
+    // are answered. Returns an identifier for the other functions, 0 on error.
+    int addAutoResponse(const QCanBusFrame &response);
+    bool updateAutoResponsePayload(int responseId, const char *payload, int size);
+    bool removeAutoResponse(int responseId);
+    void removeAutoResponses();
+    bool isAutoResponseInHardware(int responseId) const;
+    // Timing calculated for the configured bit rates and sample points, on
+    // the clock of the open channel or the default one otherwise. Invalid
+    // for a predefined CANLIB bit rate or no data phase.
+    KvaserBitTiming nominalBitTiming() const { return m_nominalTiming; }
+    KvaserBitTiming dataBitTiming() const { return m_dataTiming; }
+    QString bitTimingReport() const;
+    // Newest frames of the latest value cache, safe to call from any thread
+    // while connected. sequence receives the update number of the frame or
+    // of the newest frame returned.
+    bool latestFrame(quint32 frameId, bool extendedFrameFormat, QCanBusFrame *frame,
+                     quint64 *sequence = nullptr) const;
+    QList<QCanBusFrame> latestFrames(quint64 sinceSequence = 0, quint64 *sequence = nullptr) const;
+    // Replaces the table of periodic messages whose reception is supervised
+    // while connected, see messagesTimedOut()
+    void setSupervisedMessages(const QList<KvaserSupervisedMessage> &messages);
+    QList<KvaserSupervisedMessage> supervisedMessages() const { return m_supervisor.messages(); }
+    // Number of channels opened by this device, 1 unless aggregated
+    int channelCount() const { return qMax(1, int(m_channelNames.size())); }
+    double standardFilterPassRatio() const { return m_standardFilterPassRatio; }
+    double extendedFilterPassRatio() const { return m_extendedFilterPassRatio; }
+    // Called from the CANLIB callback thread, only posts a write if one
+    // stopped at a full driver transmit buffer.
+    void setTransmitSpaceAvailable()
+    {
+        if (m_transmitStalled.exchange(false, std::memory_order_seq_cst))
+            setTransmitReady();
+    }
+    void setTransmitReady()
+    {
+        if (!m_transmitReady.exchange(true, std::memory_order_acq_rel))
+            QMetaObject::invokeMethod(this, &KvaserCanBackend::writePendingFrames, Qt::QueuedConnection);
+    }
+    void setMessagesPending();
+    // Called from the CANLIB callback thread on status notifications, only
+    // the first one after onStatusChanged() read the status posts. The
+    // driver is never called on the callback thread.
+    void setStatusChanged()
+    {
+        if (!m_statusChanged.exchange(true, std::memory_order_acq_rel))
+            QMetaObject::invokeMethod(this, &KvaserCanBackend::onStatusChanged, Qt::QueuedConnection);
+    }
     void setMessagesAvailable()
     {
-        if (m_messagesAvailable == false) {
-            m_messagesAvailable = true;
+        // Called from the CANLIB callback and receive threads, only the
+        // first caller after onMessagesAvailable() cleared the flag posts.
+        if (!m_messagesAvailable.exchange(true, std::memory_order_acq_rel)) {
             QMetaObject::invokeMethod(this, &KvaserCanBackend::onMessagesAvailable, Qt::QueuedConnection);
         }
     }
 
+signals:
+    void busStatisticsChanged(const KvaserCanBackend::BusStatistics &statistics);
+    // All supervised messages that missed their deadline in one wheel tick
+    void messagesTimedOut(const QList<KvaserMessageTimeout> &timeouts);
+    // Emitted at most once per drain that updated the latest value cache
+    void latestFramesUpdated(quint64 sequence);
+    // Frames dropped from the full receive queue in one delivery
+    void framesDropped(qint64 frames);
+    // The replay reached the end of the trace or was stopped
+    void replayFinished();
+    // busStatus() changed, the state is the one it changed to
+    void busStateChanged(const KvaserCanBackend::BusState &state);
+
 public slots:
     void onMessagesAvailable();
     void onStatusChanged();
-    void onBusOnOff();
     void onDeviceRemoved();
+    void flushReceivedFrames();
+    void writePendingFrames();
+    void sampleBusStatistics();
+    void superviseCycleTimes();
+    void onReplayFinished();
 
 private:
+    template <int MaxPayloadSize>
+    quint64 drainMessages(quint64 maxMessages);
+    template <int MaxPayloadSize>
+    void appendReceivedFrame(const KvaserMessage<MaxPayloadSize> &message, qint64 timestamp, quint8 channel);
+    template <typename Sink>
+    quint64 mergeMembers(quint64 maxMessages, Sink sink);
+    void fetchHead(KvaserMemberChannel *member);
+    quint64 drainMembers(quint64 maxMessages);
+    template <int RecordPayloadSize>
+    qint64 readRecords(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords);
+    template <int RecordPayloadSize>
+    qint64 readRecordsDirect(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords);
+    template <int MaxPayloadSize, int RecordPayloadSize>
+    qint64 readRecordsCopied(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords);
+    template <int RecordPayloadSize>
+    qint64 readRecordsMerged(FrameRecord<RecordPayloadSize> *records, qint64 maxRecords);
+    template <int RecordPayloadSize>
+    bool fillRecord(FrameRecord<RecordPayloadSize> *record, long id, quint32 dlc, quint32 flags,
+                    qint64 timestamp, quint8 channel);
+    bool acceptMessage(long id, quint32 dlc, quint32 payloadSize, quint32 flags, qint64 timestamp,
+                       quint8 channel, const char *payload);
+    KvaserHandle openChannel(const QString &interfaceName, int flags, quint64 *serial);
+    bool openMembers(int flags);
+    QVarLengthArray<KvaserHandle, 8> channelHandles() const;
+    void synchronizeTimestamps();
+    QCanBusFrame::FrameErrors errorFramePayload(quint32 flags, char *payload);
+    qint64 receiveBatchTimeout() const;
+    bool receiveBatchDue() const;
+    qint64 receiveQueueLimit() const;
+    void dropOverflowingFrames();
+    void setErrorFrame(QCanBusFrame *frame, quint32 flags);
+    void recordDrain(quint64 messages);
+    bool startReceiveThread();
+    void stopReceiveThread();
+    void resumeReceiveThread();
+    void respondToRemoteRequest(KvaserHandle handle, long id, quint32 flags);
+    KvaserHandle openThreadHandle(bool transmitEcho);
+    void closeThreadHandle(KvaserHandle handle);
+    void startBusStatistics();
+    void stopBusStatistics();
+    void startCycleSupervision();
+    void startCapture();
+    void releaseReplayThread();
+    void updateBusState();
+    KvaserStatus writeToDriver(const QCanBusFrame &frame);
+    int startPeriodicBuffer(quint32 frameId, quint32 flags, const char *payload, quint32 length,
+                            quint32 periodMicroSeconds);
+    int startAutoResponseBuffer(quint32 frameId, quint32 flags, const char *payload, quint32 length);
     bool applyConfigurationParameter(ConfigurationKey key, const QVariant &value);
     void setupChannel(const QString& interfaceName);
     void setupDefaultConfigurations();
@@ -91,17 +506,172 @@ private:
     bool setBitRate(quint32 bitrate);
     bool setDataBitRate(quint32 bitrate);
     bool setCanFd(bool enable);
+    bool setSamplePoint(double samplePoint);
+    bool setDataSamplePoint(double samplePoint);
+    bool applyBusParameters();
+    KvaserStatus setBusParameters(KvaserHandle handle, bool dataPhase,
+                                  qint32 predefinedNominal, const KvaserBitTiming &nominal,
+                                  qint32 predefinedData, const KvaserBitTiming &data);
+    bool setReceiveThread(bool enable);
+    bool setReceiveBatchSize(quint32 frames);
+    bool setReceiveBatchTimeout(quint32 microseconds);
+    bool setHostTimestamps(bool enable);
+    bool setLatencyTracing(bool enable);
+    bool setBusStatisticsInterval(quint32 milliseconds);
+    bool setTrafficProfiler(bool enable);
+    bool setDeliveryMode(int mode);
+    bool setLatestValueCapacity(quint32 identifiers);
+    bool setReceiveQueueLimit(quint32 frames);
+    bool setReceiveQueueByteLimit(quint32 bytes);
+    bool setReceiveOverflowPolicy(int policy);
+    bool setCaptureFile(const QString &path);
+    bool setCaptureFileSize(qint64 bytes);
+    bool setCaptureRotationInterval(quint32 seconds);
+    bool setMergeWindow(quint32 microseconds);
+    quint32 setTimerScale(KvaserHandle handle);
     bool setFilters(const QList<QCanBusDevice::Filter>& filterList);
+    bool setAcceptanceFilter(quint32 code, quint32 mask, int format);
+    void restoreAcceptanceFilters();
     bool setDriverMode(KvaserDriverMode mode);
     bool setBusOn();
     bool updateSettingsAllowed();
+    // An interface name that is a comma-separated list of unique channel IDs
+    // opens all of them as one aggregated device. Its frames are delivered
+    // as a single stream merged by timestamp, FrameRecord::channel and the
+    // capture records hold the position of the channel in the list. The
+    // configuration applies to every channel, frames are written to and bus
+    // status, statistics and error counters are read from the first one.
+    // Channels of different devices are merged on host timestamps, open()
+    // fails if a device timer cannot be synchronized to the host clock.
     QString m_interfaceName;
+    QStringList m_channelNames;
+    // The first member's handle is also m_kvaserHandle
+    std::vector<KvaserMemberChannel> m_members;
+    quint32 m_mergeWindow = 0;
     KvaserHandle m_kvaserHandle = -1;
+    // Channel and open flags of m_kvaserHandle, for the thread handles
+    int m_channelIndex = -1;
+    int m_openFlags = 0;
+    // Used by the receive, periodic scheduler and replay thread only
+    KvaserHandle m_receiveHandle = -1;
+    KvaserHandle m_periodicHandle = -1;
+    KvaserHandle m_replayHandle = -1;
     bool m_initAccess = true;
-    bool m_messagesAvailable = false;
+    std::atomic<bool> m_messagesAvailable{false};
+    std::atomic<bool> m_transmitReady{false};
+    std::atomic<bool> m_transmitStalled{false};
+    QCanBusFrame m_heldFrame;
+    bool m_hasHeldFrame = false;
+    bool m_waitingForFramesWritten = false;
     bool m_canFd = false;
+    bool m_channelIsCanFd = false;
+    quint32 m_bitRate = 0;
+    quint32 m_dataBitRate = 0;
+    double m_samplePoint = 0.0;
+    double m_dataSamplePoint = 0.0;
+    // Controller clock of the first channel, 0 until opened or unknown
+    quint32 m_clockFrequency = 0;
+    KvaserBitTiming m_nominalTiming;
+    KvaserBitTiming m_dataTiming;
+    bool m_useReceiveThread = false;
+    KvaserReceiveThreadBase *m_receiveThread = nullptr;
+    QList<QCanBusFrame> m_receivedFrames;
+    quint32 m_receiveBatchSize = 0;
+    quint32 m_receiveBatchTimeout = 0;
+    QElapsedTimer m_receiveBatchAge;
+    QTimer *m_receiveBatchTimer = nullptr;
+    quint32 m_receiveQueueLimit = 0;
+    quint32 m_receiveQueueByteLimit = 0;
+    OverflowPolicy m_overflowPolicy = DropOldestFrames;
+    QTimer *m_receivePollTimer = nullptr;
+    bool m_hostTimestamps = false;
+    KvaserTimestampConverter m_timestamps;
+    KvaserFilterMatcher m_filter;
+    bool m_errorCountersValid = false;
+    // Packed status snapshot written by updateBusState(), see busState()
+    std::atomic<quint64> m_busState{0};
+    std::atomic<bool> m_statusChanged{false};
+    CanBusStatus m_reportedBusStatus = CanBusStatus::Unknown;
+    quint32 m_txErrorCounter = 0;
+    quint32 m_rxErrorCounter = 0;
+    struct {
+        KvaserCounter receivedFrames;
+        KvaserCounter receivedBytes;
+        KvaserCounter filteredFrames;
+        KvaserCounter errorFrames;
+        KvaserCounter hardwareOverruns;
+        KvaserCounter softwareOverruns;
+        KvaserCounter writtenFrames;
+        KvaserCounter writtenBytes;
+        KvaserCounter writeFailures;
+        KvaserCounter transmitBufferFull;
+        KvaserCounter drains;
+        KvaserCounter drainBatchSizes[DrainBatchBuckets];
+        KvaserCounter cacheOverflows;
+        KvaserCounter droppedFrames;
+    } m_statistics;
+    std::atomic<bool> m_latencyTracing{false};
+    std::atomic<qint64> m_traceNotifyTime{0};
+    qint64 m_traceBatchNotifyTime = 0;
+    qint64 m_traceBatchReadTime = 0;
+    KvaserLatencyHistogram m_latency[LatencyStageCount];
+    quint32 m_busStatisticsInterval = 0;
+    QTimer *m_busStatisticsTimer = nullptr;
+    bool m_busStatisticsRequested = false;
+    BusStatistics m_busStatistics;
+    bool m_profileTraffic = false;
+    KvaserTrafficProfiler m_profiler;
+    KvaserCycleSupervisor m_supervisor;
+    QTimer *m_supervisionTimer = nullptr;
+    qint64 m_drainTime = 0;
+    DeliveryMode m_deliveryMode = QueuedDelivery;
+    DeliveryMode m_activeDeliveryMode = QueuedDelivery;
+    quint32 m_latestValueCapacity = 1024;
+    quint64 m_notifiedSequence = 0;
+    KvaserLatestValueCache m_latestValues;
+    QString m_captureFile;
+    qint64 m_captureFileSize = 256 * 1024 * 1024;
+    quint32 m_captureRotationInterval = 0;
+    KvaserCaptureWriter m_capture;
+    // Guards the replay thread pointer and the last statistics against
+    // replayStatistics() from other threads
+    mutable QMutex m_replayMutex;
+    KvaserReplayThread *m_replayThread = nullptr;
+    quint64 m_replayGeneration = 0;
+    ReplayStatistics m_lastReplayStatistics;
+    // A periodic frame is either in an object buffer or a scheduler message
+    struct PeriodicFrame
+    {
+        quint32 frameId = 0;
+        quint32 flags = 0;
+        int objectBuffer = -1;
+        KvaserPeriodicMessage *message = nullptr;
+    };
+    QHash<int, PeriodicFrame> m_periodicFrames;
+    int m_nextPeriodicId = 1;
+    KvaserPeriodicScheduler *m_periodicScheduler = nullptr;
+    struct AutoResponse
+    {
+        quint32 frameId = 0;
+        quint32 flags = 0;
+        int objectBuffer = -1;
+    };
+    QHash<int, AutoResponse> m_autoResponses;
+    int m_nextAutoResponseId = 1;
+    KvaserAutoResponder m_responder;
+    bool m_replaying = false;
+    double m_standardFilterPassRatio = 1.0;
+    double m_extendedFilterPassRatio = 1.0;
+    // Covering hardware filter of the current filter list, all pass until set
+    quint32 m_standardFilterCode = 0;
+    quint32 m_standardFilterMask = 0;
+    quint32 m_extendedFilterCode = 0;
+    quint32 m_extendedFilterMask = 0;
 };
 
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(QT_PREPEND_NAMESPACE(KvaserCanBackend)::BusStatistics)
+Q_DECLARE_METATYPE(QT_PREPEND_NAMESPACE(KvaserCanBackend)::BusState)
+
 #endif // KVASERCANBACKEND_H
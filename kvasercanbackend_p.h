@@ -0,0 +1,379 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANBACKEND_P_H
+#define KVASERCANBACKEND_P_H
+
+#include "kvasercan_symbols_p.h"
+#include "kvasercancommon_p.h"
+
+#include <QtCore/qsemaphore.h>
+#include <QtCore/qthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+QT_BEGIN_NAMESPACE
+
+// A message as returned by canRead. The payload size is a template argument
+// so that classic CAN channels only ever use 8 byte buffers.
+template <int MaxPayloadSize>
+struct KvaserMessage
+{
+    long id;
+    quint32 dlc;
+    quint32 flags;
+    unsigned long time;
+    char payload[MaxPayloadSize];
+};
+
+template <int MaxPayloadSize>
+inline KvaserStatus readMessage(KvaserHandle handle, KvaserMessage<MaxPayloadSize> *message)
+{
+    return canRead(handle, &message->id, message->payload, &message->dlc,
+                   &message->flags, &message->time);
+}
+
+// Converts the 32 bit timer values of canRead into wrap-free 64 bit
+// microsecond timestamps, optionally mapped onto hostMicroSeconds().
+//
+// Each value is extended by its signed distance to the previous one, which
+// is correct as long as consecutive values are less than 2^31 ticks apart.
+// synchronize() refreshes the reference from kvReadTimer64 once per second,
+// so long silent periods do not break the extension either. The same samples
+// estimate offset and rate of the device clock against the host clock.
+class KvaserTimestampConverter
+{
+public:
+    void reset(KvaserHandle handle, quint32 microSecondsPerTick, bool hostAligned)
+    {
+        *this = KvaserTimestampConverter();
+        m_handle = handle;
+        m_microSecondsPerTick = microSecondsPerTick;
+        m_hostAligned = hostAligned;
+    }
+
+    quint32 microSecondsPerTick() const { return m_microSecondsPerTick; }
+    bool hostSynchronized() const { return m_hostSynchronized; }
+
+    void synchronize(bool force = false)
+    {
+        if (kvReadTimer64 == nullptr || m_handle < 0)
+            return;
+
+        const qint64 hostBefore = hostMicroSeconds();
+        if (!force && hostBefore - m_lastSynchronization < synchronizationInterval)
+            return;
+        qint64 ticks = 0;
+        if (kvReadTimer64(m_handle, &ticks) != KvaserStatus::OK)
+            return;
+        const qint64 hostAfter = hostMicroSeconds();
+        m_lastSynchronization = hostAfter;
+        m_synchronizedTime = ticks * m_microSecondsPerTick;
+        m_hasSample = true;
+        m_reference = quint64(ticks);
+        m_hasReference = true;
+
+        // A slow round trip says little about when the timer was sampled
+        if (!m_hostAligned || hostAfter - hostBefore > maximumSampleUncertainty)
+            return;
+
+        const qint64 deviceTime = ticks * m_microSecondsPerTick;
+        const qint64 hostTime = hostBefore + (hostAfter - hostBefore) / 2;
+        if (!m_hostSynchronized) {
+            m_deviceAnchor = deviceTime;
+            m_hostAnchor = hostTime;
+            m_hostSynchronized = true;
+            return;
+        }
+
+        // Correct the rate by part of the drift observed since the last
+        // sample and slew the offset, instead of jumping to the new sample.
+        const qint64 elapsed = deviceTime - m_deviceAnchor;
+        if (elapsed <= 0)
+            return;
+        const qint64 predicted = toHostTime(deviceTime);
+        const double error = double(hostTime - predicted);
+        m_rate += rateGain * error / double(elapsed);
+        m_hostAnchor = predicted + qint64(offsetGain * error);
+        m_deviceAnchor = deviceTime;
+    }
+
+    // Current time on the scale of toMicroSeconds() without calling the
+    // driver. Device time is extrapolated on the host clock from the last
+    // synchronize(), so it is off by the drift of up to one interval. False
+    // before a synchronize() read the timer.
+    bool currentTime(qint64 *microSeconds) const
+    {
+        if (!m_hasSample)
+            return false;
+        const qint64 host = hostMicroSeconds();
+        *microSeconds = m_hostSynchronized ? host : m_synchronizedTime + (host - m_lastSynchronization);
+        return true;
+    }
+
+    qint64 toMicroSeconds(unsigned long time)
+    {
+        const quint32 low = quint32(time);
+        if (Q_UNLIKELY(!m_hasReference)) {
+            m_reference = low;
+            m_hasReference = true;
+        } else {
+            m_reference += qint64(qint32(low - quint32(m_reference)));
+        }
+
+        const qint64 deviceTime = qint64(m_reference) * m_microSecondsPerTick;
+        if (!m_hostSynchronized)
+            return deviceTime;
+        return toHostTime(deviceTime);
+    }
+
+private:
+    static constexpr qint64 synchronizationInterval = 1000000;
+    static constexpr qint64 maximumSampleUncertainty = 2000;
+    static constexpr double rateGain = 0.25;
+    static constexpr double offsetGain = 0.25;
+
+    qint64 toHostTime(qint64 deviceTime) const
+    {
+        return m_hostAnchor + qint64(double(deviceTime - m_deviceAnchor) * m_rate);
+    }
+
+    KvaserHandle m_handle = -1;
+    qint64 m_microSecondsPerTick = 1000;
+    bool m_hostAligned = false;
+    bool m_hasReference = false;
+    quint64 m_reference = 0;
+    qint64 m_lastSynchronization = 0;
+    qint64 m_synchronizedTime = 0;
+    bool m_hasSample = false;
+    bool m_hostSynchronized = false;
+    qint64 m_deviceAnchor = 0;
+    qint64 m_hostAnchor = 0;
+    double m_rate = 1.0;
+};
+
+// Member channel of a device opened with a comma-separated interface name.
+// head is the oldest message read from the channel that was not merged
+// into the received stream yet.
+struct KvaserMemberChannel
+{
+    KvaserHandle handle = -1;
+    KvaserTimestampConverter timestamps;
+    KvaserMessage<64> head;
+    qint64 headTimestamp = 0;
+    bool hasHead = false;
+    bool drained = false;
+};
+
+// Bounded lock-free single-producer/single-consumer ring buffer. Exactly one
+// thread may push and exactly one other thread may pop.
+template <typename T>
+class KvaserSpscRing
+{
+    Q_DISABLE_COPY(KvaserSpscRing)
+
+public:
+    explicit KvaserSpscRing(quint32 capacity)
+    {
+        quint32 size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_slots.reset(new T[size]);
+    }
+
+    quint32 capacity() const { return m_mask + 1; }
+
+    // Returns the slot to fill next, or nullptr if the ring is full.
+    // The slot becomes visible to the consumer with commitPush().
+    T *beginPush()
+    {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) > m_mask)
+            return nullptr;
+        return &m_slots[head & m_mask];
+    }
+
+    void commitPush()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(T *item)
+    {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        *item = m_slots[tail & m_mask];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<quint32> m_head{0};
+    alignas(64) std::atomic<quint32> m_tail{0};
+    quint32 m_mask = 0;
+    std::unique_ptr<T[]> m_slots;
+};
+
+// Drains canRead on a backend-owned thread, so that receiving does not
+// depend on how busy the Qt event loop of the backend is.
+class KvaserReceiveThreadBase : public QThread
+{
+public:
+    // remoteRequest is called with the handle of the thread and the
+    // identifier and flags of every remote request frame as soon as it was
+    // read. Nothing else may use the handle while the thread runs.
+    KvaserReceiveThreadBase(KvaserHandle handle, std::function<void()> notify,
+                            std::function<void(KvaserHandle, long, quint32)> remoteRequest)
+        : m_handle(handle), m_notify(std::move(notify)), m_remoteRequest(std::move(remoteRequest))
+    {
+    }
+
+    // Called from the CANLIB callback thread. Wakeups are coalesced, so at
+    // most one is pending no matter how many notifications arrive.
+    void wakeUp()
+    {
+        if (!m_wakeUpPending.exchange(true, std::memory_order_acq_rel))
+            m_wakeUp.release();
+    }
+
+    // Called by the consumer after popping, restarts a drain that stopped
+    // because the ring was full.
+    void resumeIfStalled()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_stalled.exchange(false, std::memory_order_relaxed))
+            wakeUp();
+    }
+
+    void stop()
+    {
+        requestInterruption();
+        m_wakeUp.release();
+        wait();
+    }
+
+    KvaserStatus takeReadError()
+    {
+        return KvaserStatus(m_readError.exchange(int(KvaserStatus::OK), std::memory_order_relaxed));
+    }
+
+protected:
+    virtual bool drain() = 0;
+
+    void run() override
+    {
+        while (!isInterruptionRequested()) {
+            m_wakeUp.acquire();
+            // Clear before draining, so that notifications arriving while
+            // draining trigger another pass.
+            m_wakeUpPending.store(false, std::memory_order_release);
+            if (isInterruptionRequested())
+                break;
+            if (drain())
+                m_notify();
+        }
+    }
+
+    KvaserHandle m_handle;
+    std::function<void()> m_notify;
+    std::function<void(KvaserHandle, long, quint32)> m_remoteRequest;
+    QSemaphore m_wakeUp;
+    std::atomic<bool> m_wakeUpPending{false};
+    std::atomic<bool> m_stalled{false};
+    std::atomic<int> m_readError{int(KvaserStatus::OK)};
+};
+
+template <int MaxPayloadSize>
+class KvaserReceiveThread : public KvaserReceiveThreadBase
+{
+public:
+    KvaserReceiveThread(KvaserHandle handle, quint32 capacity, std::function<void()> notify,
+                        std::function<void(KvaserHandle, long, quint32)> remoteRequest)
+        : KvaserReceiveThreadBase(handle, std::move(notify), std::move(remoteRequest)), m_ring(capacity)
+    {
+    }
+
+    bool pop(KvaserMessage<MaxPayloadSize> *message)
+    {
+        return m_ring.pop(message);
+    }
+
+protected:
+    // Returns true if messages were added to the ring or an error occurred
+    bool drain() override
+    {
+        bool notify = false;
+        for (;;) {
+            KvaserMessage<MaxPayloadSize> *message = m_ring.beginPush();
+            if (!message) {
+                // Leave the rest in the driver queue until the consumer has
+                // made room. Check again after raising the flag, in case the
+                // consumer emptied the ring before it could see the flag.
+                m_stalled.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                message = m_ring.beginPush();
+                if (!message)
+                    break;
+                m_stalled.store(false, std::memory_order_relaxed);
+            }
+            const KvaserStatus result = readMessage(m_handle, message);
+            if (result == KvaserStatus::NoMessages)
+                break;
+            if (result != KvaserStatus::OK) {
+                m_readError.store(int(result), std::memory_order_relaxed);
+                notify = true;
+                break;
+            }
+            if (Q_UNLIKELY(message->flags & KVASER_MESSAGE_REMOTE_REQUEST) && m_remoteRequest)
+                m_remoteRequest(m_handle, message->id, message->flags);
+            m_ring.commitPush();
+            notify = true;
+        }
+        return notify;
+    }
+
+private:
+    KvaserSpscRing<KvaserMessage<MaxPayloadSize>> m_ring;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANBACKEND_P_H
@@ -0,0 +1,167 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercancache_p.h"
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+void KvaserLatestValueCache::allocate(int capacity)
+{
+    m_standard.reset(new Entry[StandardEntries]);
+    m_extendedCapacity = qMax(capacity, 0);
+    m_extendedCount = 0;
+    m_extendedMask = 0;
+    m_extended.reset();
+    if (m_extendedCapacity > 0) {
+        // At most half full, so probe sequences stay short
+        quint32 size = 64;
+        while (size < quint32(m_extendedCapacity) * 2)
+            size *= 2;
+        m_extended.reset(new Slot[size]);
+        m_extendedMask = size - 1;
+    }
+    m_sequence.store(0, std::memory_order_relaxed);
+}
+
+void KvaserLatestValueCache::release()
+{
+    m_standard.reset();
+    m_extended.reset();
+    m_extendedMask = 0;
+    m_extendedCapacity = 0;
+    m_extendedCount = 0;
+}
+
+bool KvaserLatestValueCache::update(quint32 frameId, quint32 flags, const char *payload,
+                                    quint32 payloadSize, qint64 timestamp)
+{
+    if (!(flags & ExtendedFrameFormat)) {
+        writeEntry(m_standard[frameId & 0x7FF], frameId & 0x7FF, flags, payload, payloadSize, timestamp);
+        return true;
+    }
+
+    if (!m_extended)
+        return false;
+    const quint32 key = (frameId & 0x1FFFFFFF) | 0x80000000;
+    for (quint32 index = slotIndex(key); ; index = (index + 1) & m_extendedMask) {
+        Slot &slot = m_extended[index];
+        const quint32 slotKey = slot.key.load(std::memory_order_relaxed);
+        if (slotKey == key) {
+            writeEntry(slot.entry, frameId & 0x1FFFFFFF, flags, payload, payloadSize, timestamp);
+            return true;
+        }
+        if (slotKey == 0) {
+            if (m_extendedCount == m_extendedCapacity)
+                return false;
+            ++m_extendedCount;
+            // Readers only look at the entry once the key is published
+            writeEntry(slot.entry, frameId & 0x1FFFFFFF, flags, payload, payloadSize, timestamp);
+            slot.key.store(key, std::memory_order_release);
+            return true;
+        }
+    }
+}
+
+bool KvaserLatestValueCache::read(quint32 frameId, bool extended, KvaserCachedFrame *frame) const
+{
+    if (!m_standard)
+        return false;
+    if (!extended)
+        return readEntry(m_standard[frameId & 0x7FF], frame);
+
+    if (!m_extended)
+        return false;
+    const quint32 key = (frameId & 0x1FFFFFFF) | 0x80000000;
+    for (quint32 index = slotIndex(key); ; index = (index + 1) & m_extendedMask) {
+        const Slot &slot = m_extended[index];
+        const quint32 slotKey = slot.key.load(std::memory_order_acquire);
+        if (slotKey == key)
+            return readEntry(slot.entry, frame);
+        if (slotKey == 0)
+            return false;
+    }
+}
+
+void KvaserLatestValueCache::writeEntry(Entry &entry, quint32 frameId, quint32 flags, const char *payload,
+                                        quint32 payloadSize, qint64 timestamp)
+{
+    quint64 words[PayloadWords] = {};
+    payloadSize = qMin(payloadSize, quint32(sizeof(words)));
+    memcpy(words, payload, payloadSize);
+    const quint64 sequence = m_sequence.load(std::memory_order_relaxed) + 1;
+
+    const quint32 lock = entry.lock.load(std::memory_order_relaxed);
+    entry.lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.frameId.store(frameId, std::memory_order_relaxed);
+    entry.flags.store(flags, std::memory_order_relaxed);
+    entry.payloadSize.store(payloadSize, std::memory_order_relaxed);
+    entry.timestamp.store(timestamp, std::memory_order_relaxed);
+    entry.sequence.store(sequence, std::memory_order_relaxed);
+    for (quint32 word = 0; word < (payloadSize + 7) / 8; ++word)
+        entry.payload[word].store(words[word], std::memory_order_relaxed);
+    entry.lock.store(lock + 2, std::memory_order_release);
+
+    m_sequence.store(sequence, std::memory_order_release);
+}
+
+bool KvaserLatestValueCache::readEntry(const Entry &entry, KvaserCachedFrame *frame)
+{
+    quint64 words[PayloadWords];
+    for (;;) {
+        const quint32 lock = entry.lock.load(std::memory_order_acquire);
+        if (lock == 0)
+            return false;
+        if (lock & 1)
+            continue;
+        frame->frameId = entry.frameId.load(std::memory_order_relaxed);
+        frame->flags = entry.flags.load(std::memory_order_relaxed);
+        frame->payloadSize = qMin(entry.payloadSize.load(std::memory_order_relaxed), quint32(sizeof(words)));
+        frame->timestamp = entry.timestamp.load(std::memory_order_relaxed);
+        frame->sequence = entry.sequence.load(std::memory_order_relaxed);
+        for (quint32 word = 0; word < (frame->payloadSize + 7) / 8; ++word)
+            words[word] = entry.payload[word].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.lock.load(std::memory_order_relaxed) == lock)
+            break;
+    }
+    memcpy(frame->payload, words, frame->payloadSize);
+    return true;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,143 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANCACHE_P_H
+#define KVASERCANCACHE_P_H
+
+#include <QtCore/qglobal.h>
+
+#include <atomic>
+#include <memory>
+
+QT_BEGIN_NAMESPACE
+
+// Newest frame of one identifier as read from KvaserLatestValueCache.
+// sequence is the cache wide update number of the frame.
+struct KvaserCachedFrame
+{
+    quint32 frameId = 0;
+    quint32 flags = 0;
+    quint32 payloadSize = 0;
+    qint64 timestamp = 0;
+    quint64 sequence = 0;
+    char payload[64];
+};
+
+// Table of the newest frame per identifier with a fixed capacity: 2048
+// entries for 11 bit identifiers and an open addressing table for up to
+// capacity 29 bit identifiers, which drops frames of further identifiers.
+// One thread updates the table, any thread may read it without locking.
+// Every entry is a sequence lock: the writer makes the sequence odd while
+// it changes the entry, readers retry when they saw an odd or changed
+// sequence. All fields are relaxed atomics, so torn reads are detected
+// instead of being undefined behavior.
+class KvaserLatestValueCache
+{
+public:
+    enum Flag : quint32 {
+        ExtendedFrameFormat = 0x1,
+        FlexibleDataRateFormat = 0x2,
+        BitrateSwitch = 0x4,
+        RemoteRequest = 0x8
+    };
+
+    // Discards all entries, not thread safe with readers
+    void allocate(int capacity);
+    void release();
+    bool isAllocated() const { return m_standard != nullptr; }
+
+    // Returns false if the identifier did not fit into the table
+    bool update(quint32 frameId, quint32 flags, const char *payload, quint32 payloadSize, qint64 timestamp);
+
+    bool read(quint32 frameId, bool extended, KvaserCachedFrame *frame) const;
+    // Calls function(const KvaserCachedFrame &) for every entry updated
+    // after the given sequence number
+    template <typename Function>
+    void forEachSince(quint64 sequence, Function function) const
+    {
+        KvaserCachedFrame frame;
+        for (int index = 0; index < StandardEntries; ++index) {
+            if (readEntry(m_standard[index], &frame) && frame.sequence > sequence)
+                function(frame);
+        }
+        for (quint32 index = 0; index <= m_extendedMask && m_extended; ++index) {
+            if (m_extended[index].key.load(std::memory_order_acquire) != 0
+                    && readEntry(m_extended[index].entry, &frame) && frame.sequence > sequence) {
+                function(frame);
+            }
+        }
+    }
+    // Number of the last update, readable from any thread
+    quint64 sequence() const { return m_sequence.load(std::memory_order_acquire); }
+
+private:
+    static constexpr int StandardEntries = 2048;
+    static constexpr int PayloadWords = 64 / 8;
+
+    struct Entry
+    {
+        std::atomic<quint32> lock{0};
+        std::atomic<quint32> frameId{0};
+        std::atomic<quint32> flags{0};
+        std::atomic<quint32> payloadSize{0};
+        std::atomic<qint64> timestamp{0};
+        std::atomic<quint64> sequence{0};
+        std::atomic<quint64> payload[PayloadWords] = {};
+    };
+
+    struct Slot
+    {
+        // Identifier with bit 31 set, 0 marks a free slot
+        std::atomic<quint32> key{0};
+        Entry entry;
+    };
+
+    quint32 slotIndex(quint32 key) const { return (key * 0x9E3779B1u) >> 7 & m_extendedMask; }
+    void writeEntry(Entry &entry, quint32 frameId, quint32 flags, const char *payload,
+                    quint32 payloadSize, qint64 timestamp);
+    static bool readEntry(const Entry &entry, KvaserCachedFrame *frame);
+
+    std::unique_ptr<Entry[]> m_standard;
+    std::unique_ptr<Slot[]> m_extended;
+    quint32 m_extendedMask = 0;
+    int m_extendedCapacity = 0;
+    int m_extendedCount = 0;
+    std::atomic<quint64> m_sequence{0};
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANCACHE_P_H
@@ -0,0 +1,159 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercancapture_p.h"
+#include "kvasercancommon_p.h"
+
+#include <QtCore/qdir.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qloggingcategory.h>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_CANBUS_PLUGINS_KVASERCAN)
+
+bool KvaserCaptureWriter::open(const QString &path, qint64 fileSize, qint64 rotationInterval,
+                               bool hostTimestamps, QString *errorString)
+{
+    close();
+    m_path = path;
+    // A file must at least hold its header, one full frame and an index
+    m_fileSize = qMax(fileSize, qint64(4096));
+    m_rotationInterval = rotationInterval;
+    m_hostTimestamps = hostTimestamps;
+    m_sequence = 0;
+    return openFile(errorString);
+}
+
+void KvaserCaptureWriter::close()
+{
+    if (m_data)
+        closeFile();
+}
+
+QString KvaserCaptureWriter::fileName(quint32 sequence) const
+{
+    const QFileInfo info(m_path);
+    QString name = info.completeBaseName() + QLatin1Char('.')
+            + QStringLiteral("%1").arg(sequence, 4, 10, QLatin1Char('0'));
+    if (!info.suffix().isEmpty())
+        name += QLatin1Char('.') + info.suffix();
+    return info.dir().filePath(name);
+}
+
+bool KvaserCaptureWriter::openFile(QString *errorString)
+{
+    m_file.setFileName(fileName(m_sequence));
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        *errorString = m_file.errorString();
+        return false;
+    }
+    if (!m_file.resize(m_fileSize)) {
+        *errorString = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    m_data = m_file.map(0, m_fileSize);
+    if (!m_data) {
+        *errorString = m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_size = m_fileSize;
+    m_offset = sizeof(KvaserCaptureFileHeader);
+    m_fileStartTime = hostMicroSeconds();
+    m_segmentStart = m_offset;
+    m_segmentRecords = 0;
+
+    KvaserCaptureFileHeader fileHeader = {};
+    memcpy(fileHeader.magic, "KVCAPTR", 8);
+    fileHeader.byteOrder = 0x01020304;
+    fileHeader.version = 1;
+    fileHeader.headerSize = sizeof(KvaserCaptureFileHeader);
+    fileHeader.startTime = m_fileStartTime;
+    fileHeader.dataEnd = quint64(m_offset);
+    fileHeader.sequence = m_sequence;
+    fileHeader.hostTimestamps = m_hostTimestamps ? 1 : 0;
+    memcpy(m_data, &fileHeader, sizeof(fileHeader));
+    return true;
+}
+
+void KvaserCaptureWriter::closeFile()
+{
+    if (m_segmentRecords > 0)
+        writeIndex();
+    header()->dataEnd = quint64(m_offset);
+    m_file.unmap(m_data);
+    m_data = nullptr;
+    m_file.resize(m_offset);
+    m_file.close();
+}
+
+bool KvaserCaptureWriter::rotate()
+{
+    closeFile();
+    ++m_sequence;
+    QString errorString;
+    if (!openFile(&errorString)) {
+        qCWarning(QT_CANBUS_PLUGINS_KVASERCAN, "Capture stopped, cannot open %ls: %ls.",
+                  qUtf16Printable(m_file.fileName()), qUtf16Printable(errorString));
+        return false;
+    }
+    return true;
+}
+
+void KvaserCaptureWriter::writeIndex()
+{
+    KvaserCaptureFileHeader *fileHeader = header();
+
+    KvaserCaptureIndexRecord index;
+    index.type = KvaserCaptureIndexType;
+    index.size = sizeof(KvaserCaptureIndexRecord);
+    index.records = m_segmentRecords;
+    index.previousIndex = fileHeader->lastIndex;
+    index.firstRecord = quint64(m_segmentStart);
+    index.firstTimestamp = m_segmentFirstTimestamp;
+    index.lastTimestamp = m_segmentLastTimestamp;
+    memcpy(m_data + m_offset, &index, sizeof(index));
+
+    fileHeader->lastIndex = quint64(m_offset);
+    m_offset += sizeof(index);
+    m_segmentStart = m_offset;
+    m_segmentRecords = 0;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,199 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANCAPTURE_P_H
+#define KVASERCANCAPTURE_P_H
+
+#include <QtCore/qfile.h>
+#include <QtCore/qstring.h>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+// Capture file format, all fields in host byte order (see byteOrder):
+//
+// The file starts with a 64 byte KvaserCaptureFileHeader, followed by
+// records up to dataEnd. Every record starts with a 16 bit type and a 16
+// bit size that includes the record header and padding, so records are 8
+// byte aligned and unknown types can be skipped.
+//
+// Frame records (type 1) are a KvaserCaptureFrameRecord followed by length
+// payload bytes. id, dlc and flags are the values canRead() returned, the
+// flags are the CANLIB canMSG_* and canFDMSG_* bits. timestamp is in
+// microseconds, on the host monotonic clock if hostTimestamps is set in the
+// file header.
+//
+// Index records (type 2) are written after every 1 MiB of frame records
+// and when the file is closed. Each covers the frame records since the
+// previous index record, and they are chained through previousIndex. The
+// file header holds the offset of the last one, so a reader can find any
+// time range from the end of the file without scanning it.
+//
+// Files are preallocated to their maximum size and truncated to dataEnd
+// when closed. After a crash, dataEnd still marks the last complete
+// record. A full file, or one older than the rotation interval, is
+// continued in the next file of the sequence.
+struct KvaserCaptureFileHeader
+{
+    char magic[8];          // "KVCAPTR\0"
+    quint32 byteOrder;      // 0x01020304 written in host byte order
+    quint16 version;        // 1
+    quint16 headerSize;     // 64
+    qint64 startTime;       // host monotonic time when the file was opened, microseconds
+    quint64 dataEnd;        // end of the last complete record
+    quint64 lastIndex;      // offset of the last index record, 0 if none
+    quint32 sequence;       // number of the file in the rotation sequence
+    quint32 hostTimestamps; // 1 if frame timestamps are on the host clock
+    quint64 reserved[2];
+};
+
+struct KvaserCaptureFrameRecord
+{
+    quint16 type;           // 1
+    quint16 size;
+    quint32 flags;
+    quint32 id;
+    quint8 length;          // payload bytes following the record
+    quint8 channel;
+    quint16 dlc;
+    qint64 timestamp;
+};
+
+struct KvaserCaptureIndexRecord
+{
+    quint16 type;           // 2
+    quint16 size;
+    quint32 records;        // frame records covered
+    quint64 previousIndex;  // offset of the previous index record, 0 if none
+    quint64 firstRecord;    // offset of the first covered frame record
+    qint64 firstTimestamp;
+    qint64 lastTimestamp;
+};
+
+static_assert(sizeof(KvaserCaptureFileHeader) == 64, "Capture file header must be 64 bytes");
+static_assert(sizeof(KvaserCaptureFrameRecord) == 24, "Capture frame record must be 24 bytes");
+static_assert(sizeof(KvaserCaptureIndexRecord) == 40, "Capture index record must be 40 bytes");
+
+enum KvaserCaptureRecordType : quint16 {
+    KvaserCaptureFrameType = 1,
+    KvaserCaptureIndexType = 2
+};
+
+// Appends frame records to memory mapped capture files. append() only
+// copies into the mapping, the kernel writes the pages back. Not thread
+// safe, used from the thread that drains the channel.
+class KvaserCaptureWriter
+{
+public:
+    ~KvaserCaptureWriter() { close(); }
+
+    // fileSize is the size each file is preallocated to, rotationInterval
+    // in microseconds starts a new file after that time, 0 never does.
+    // Files are named after path with the sequence number before the suffix.
+    bool open(const QString &path, qint64 fileSize, qint64 rotationInterval, bool hostTimestamps,
+              QString *errorString);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    void append(quint32 id, quint32 dlc, quint32 flags, quint32 length, quint8 channel,
+                qint64 timestamp, const char *payload)
+    {
+        const quint32 size = quint32(sizeof(KvaserCaptureFrameRecord)) + ((length + 7) & ~7u);
+        // Room for a closing index record is always kept
+        if (Q_UNLIKELY(m_offset + size + qint64(sizeof(KvaserCaptureIndexRecord)) > m_size)) {
+            if (!rotate())
+                return;
+        }
+
+        uchar *data = m_data + m_offset;
+        KvaserCaptureFrameRecord record;
+        record.type = KvaserCaptureFrameType;
+        record.size = quint16(size);
+        record.flags = flags;
+        record.id = id;
+        record.length = quint8(length);
+        record.channel = channel;
+        record.dlc = quint16(dlc);
+        record.timestamp = timestamp;
+        memcpy(data, &record, sizeof(record));
+        memcpy(data + sizeof(record), payload, length);
+        m_offset += size;
+
+        if (m_segmentRecords++ == 0)
+            m_segmentFirstTimestamp = timestamp;
+        m_segmentLastTimestamp = timestamp;
+        if (m_offset - m_segmentStart >= IndexInterval)
+            writeIndex();
+        header()->dataEnd = quint64(m_offset);
+    }
+
+    // Starts the next file once the rotation interval has passed
+    void rotateIfDue(qint64 now)
+    {
+        if (m_rotationInterval > 0 && now - m_fileStartTime >= m_rotationInterval)
+            rotate();
+    }
+
+private:
+    static constexpr qint64 IndexInterval = 1024 * 1024;
+
+    KvaserCaptureFileHeader *header() { return reinterpret_cast<KvaserCaptureFileHeader *>(m_data); }
+    QString fileName(quint32 sequence) const;
+    bool openFile(QString *errorString);
+    void closeFile();
+    bool rotate();
+    void writeIndex();
+
+    QString m_path;
+    qint64 m_fileSize = 0;
+    qint64 m_rotationInterval = 0;
+    bool m_hostTimestamps = false;
+    quint32 m_sequence = 0;
+    QFile m_file;
+    uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_offset = 0;
+    qint64 m_fileStartTime = 0;
+    qint64 m_segmentStart = 0;
+    quint32 m_segmentRecords = 0;
+    qint64 m_segmentFirstTimestamp = 0;
+    qint64 m_segmentLastTimestamp = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANCAPTURE_P_H
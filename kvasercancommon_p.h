@@ -0,0 +1,152 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANCOMMON_P_H
+#define KVASERCANCOMMON_P_H
+
+#include "kvasercan_constants_p.h"
+
+#include <QtCore/qalgorithms.h>
+
+#include <atomic>
+#include <chrono>
+
+QT_BEGIN_NAMESPACE
+
+// Host monotonic clock shared by all channels, in microseconds
+inline qint64 hostMicroSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline qint64 hostNanoSeconds()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Statistics counter with a single writer thread and any number of readers.
+// Updating it is a plain load and store, no locked instruction.
+class KvaserCounter
+{
+public:
+    void add(quint64 value)
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    quint64 load() const { return m_value.load(std::memory_order_relaxed); }
+    void reset() { m_value.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below
+// 8 ns have their own bucket, above that every power of two is split into
+// 8 buckets, so any recorded value is known to within 12.5 percent.
+// Recording has a single writer, reading is possible from any thread.
+class KvaserLatencyHistogram
+{
+public:
+    void record(qint64 nanoSeconds)
+    {
+        const quint64 value = nanoSeconds > 0 ? quint64(nanoSeconds) : 0;
+        m_buckets[bucketIndex(value)].add(1);
+        m_count.add(1);
+        if (value > m_maximum.load(std::memory_order_relaxed))
+            m_maximum.store(value, std::memory_order_relaxed);
+    }
+
+    quint64 count() const { return m_count.load(); }
+    quint64 maximum() const { return m_maximum.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the given fraction of the values
+    quint64 percentile(double fraction) const
+    {
+        const quint64 total = count();
+        if (total == 0)
+            return 0;
+        const quint64 wanted = qMax(quint64(1), quint64(fraction * double(total) + 0.5));
+        quint64 seen = 0;
+        for (int index = 0; index < BucketCount; ++index) {
+            seen += m_buckets[index].load();
+            if (seen >= wanted)
+                return qMin(bucketUpperBound(index), maximum());
+        }
+        return maximum();
+    }
+
+    void reset()
+    {
+        for (KvaserCounter &bucket : m_buckets)
+            bucket.reset();
+        m_count.reset();
+        m_maximum.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr int SubBucketBits = 3;
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    static constexpr int BucketCount = (64 - SubBucketBits + 1) << SubBucketBits;
+
+    static int bucketIndex(quint64 value)
+    {
+        if (value < SubBuckets)
+            return int(value);
+        const int exponent = 63 - int(qCountLeadingZeroBits(value));
+        const int subBucket = int(value >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+        return ((exponent - SubBucketBits + 1) << SubBucketBits) + subBucket;
+    }
+
+    static quint64 bucketUpperBound(int index)
+    {
+        if (index < SubBuckets)
+            return quint64(index);
+        const int exponent = (index >> SubBucketBits) + SubBucketBits - 1;
+        const quint64 subBucket = quint64(index & (SubBuckets - 1));
+        const quint64 lower = (SubBuckets + subBucket) << (exponent - SubBucketBits);
+        return lower + (quint64(1) << (exponent - SubBucketBits)) - 1;
+    }
+
+    KvaserCounter m_buckets[BucketCount];
+    KvaserCounter m_count;
+    std::atomic<quint64> m_maximum{0};
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANCOMMON_P_H
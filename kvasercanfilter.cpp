@@ -0,0 +1,160 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanfilter_p.h"
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+void KvaserFilterMatcher::setFilters(const QList<QCanBusDevice::Filter> &filters)
+{
+    m_acceptAll = filters.isEmpty();
+    for (Table &table : m_tables)
+        table.clear();
+
+    for (const QCanBusDevice::Filter &filter : filters) {
+        const bool matchesData = filter.type == QCanBusFrame::DataFrame
+                || filter.type == QCanBusFrame::InvalidFrame;
+        const bool matchesRemote = filter.type == QCanBusFrame::RemoteRequestFrame
+                || filter.type == QCanBusFrame::InvalidFrame;
+        const bool matchesStandard = filter.format & QCanBusDevice::Filter::MatchBaseFormat;
+        const bool matchesExtended = filter.format & QCanBusDevice::Filter::MatchExtendedFormat;
+
+        for (int type = 0; type < 2; ++type) {
+            if (!(type == 0 ? matchesData : matchesRemote))
+                continue;
+            if (matchesStandard)
+                m_tables[type].addStandard(filter.frameId, filter.frameIdMask);
+            if (matchesExtended)
+                m_tables[type].addExtended(filter.frameId, filter.frameIdMask);
+        }
+    }
+
+    for (Table &table : m_tables)
+        table.finish();
+}
+
+void KvaserFilterMatcher::coveringFilter(const QList<QCanBusDevice::Filter> &filters, bool extended,
+                                         quint32 *code, quint32 *mask)
+{
+    const quint32 width = extended ? 0x1FFFFFFF : 0x7FF;
+    const QCanBusDevice::Filter::FormatFilter format = extended
+            ? QCanBusDevice::Filter::MatchExtendedFormat : QCanBusDevice::Filter::MatchBaseFormat;
+
+    if (filters.isEmpty()) {
+        *code = 0;
+        *mask = 0;
+        return;
+    }
+
+    // A bit can only be checked if every filter checks it and all filters
+    // expect the same value for it. If no filter accepts this format, the
+    // full mask passes identifier 0 only, which software then rejects, as
+    // the hardware filter cannot reject everything.
+    bool first = true;
+    quint32 coveringCode = 0;
+    quint32 coveringMask = width;
+    for (const QCanBusDevice::Filter &filter : filters) {
+        if (!(filter.format & format))
+            continue;
+        const quint32 filterMask = filter.frameIdMask & width;
+        const quint32 filterCode = filter.frameId & filterMask;
+        if (first) {
+            coveringCode = filterCode;
+            coveringMask = filterMask;
+            first = false;
+        } else {
+            coveringMask &= filterMask & ~(coveringCode ^ filterCode);
+            coveringCode &= coveringMask;
+        }
+    }
+
+    *code = coveringCode;
+    *mask = coveringMask;
+}
+
+void KvaserFilterMatcher::Table::clear()
+{
+    std::fill(std::begin(m_standard), std::end(m_standard), 0);
+    m_extended.clear();
+}
+
+void KvaserFilterMatcher::Table::addStandard(quint32 frameId, quint32 mask)
+{
+    mask &= 0x7FF;
+    frameId &= mask;
+    for (quint32 id = 0; id < 2048; ++id) {
+        if ((id & mask) == frameId)
+            m_standard[id >> 6] |= quint64(1) << (id & 63);
+    }
+}
+
+void KvaserFilterMatcher::Table::addExtended(quint32 frameId, quint32 mask)
+{
+    mask &= 0x1FFFFFFF;
+    frameId &= mask;
+    auto group = std::find_if(m_extended.begin(), m_extended.end(),
+                              [mask](const MaskGroup &g) { return g.mask == mask; });
+    if (group == m_extended.end()) {
+        m_extended.append(MaskGroup{mask, {}});
+        group = m_extended.end() - 1;
+    }
+    group->values.append(frameId);
+}
+
+void KvaserFilterMatcher::Table::finish()
+{
+    for (MaskGroup &group : m_extended) {
+        std::sort(group.values.begin(), group.values.end());
+        group.values.erase(std::unique(group.values.begin(), group.values.end()), group.values.end());
+    }
+    // Wider groups match more identifiers, try them first
+    std::sort(m_extended.begin(), m_extended.end(), [](const MaskGroup &a, const MaskGroup &b) {
+        return qPopulationCount(a.mask) < qPopulationCount(b.mask);
+    });
+}
+
+bool KvaserFilterMatcher::Table::acceptsExtended(quint32 frameId) const
+{
+    for (const MaskGroup &group : m_extended) {
+        if (std::binary_search(group.values.cbegin(), group.values.cend(), frameId & group.mask))
+            return true;
+    }
+    return false;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,114 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANFILTER_P_H
+#define KVASERCANFILTER_P_H
+
+#include "kvasercan_constants_p.h"
+
+#include <QtSerialBus/qcanbusdevice.h>
+
+#include <QtCore/qalgorithms.h>
+#include <QtCore/qlist.h>
+
+QT_BEGIN_NAMESPACE
+
+// Software implementation of QCanBusDevice::RawFilterKey for any number of
+// filters, compiled into lookup tables that are applied to every received
+// message before a QCanBusFrame is built.
+//
+// 11 bit identifiers are looked up in a 2048 bit bitmap. 29 bit filters are
+// grouped by mask, each group holding the sorted masked identifiers, so a
+// lookup costs one binary search per distinct mask. Data and remote request
+// frames use separate tables, error frames are never filtered.
+class KvaserFilterMatcher
+{
+public:
+    void setFilters(const QList<QCanBusDevice::Filter> &filters);
+
+    // Computes the tightest single code/mask pair that passes every
+    // identifier of the given frame format accepted by the filter list.
+    static void coveringFilter(const QList<QCanBusDevice::Filter> &filters, bool extended,
+                               quint32 *code, quint32 *mask);
+    // Fraction of the identifier space a code/mask pair lets through
+    static double passRatio(quint32 mask, bool extended)
+    {
+        const quint32 width = extended ? 0x1FFFFFFF : 0x7FF;
+        return 1.0 / double(quint64(1) << qPopulationCount(mask & width));
+    }
+
+    bool accepts(long id, quint32 flags) const
+    {
+        if (Q_LIKELY(m_acceptAll) || (flags & KVASER_MESSAGE_ERROR_FRAME))
+            return true;
+        const Table &table = m_tables[(flags & KVASER_MESSAGE_REMOTE_REQUEST) ? 1 : 0];
+        const quint32 frameId = quint32(id);
+        if (flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT)
+            return table.acceptsExtended(frameId);
+        return table.acceptsStandard(frameId);
+    }
+
+private:
+    struct MaskGroup
+    {
+        quint32 mask = 0;
+        QList<quint32> values;
+    };
+
+    struct Table
+    {
+        void clear();
+        void addStandard(quint32 frameId, quint32 mask);
+        void addExtended(quint32 frameId, quint32 mask);
+        void finish();
+        bool acceptsStandard(quint32 frameId) const
+        {
+            frameId &= 0x7FF;
+            return m_standard[frameId >> 6] & (quint64(1) << (frameId & 63));
+        }
+        bool acceptsExtended(quint32 frameId) const;
+
+        quint64 m_standard[2048 / 64];
+        QList<MaskGroup> m_extended;
+    };
+
+    bool m_acceptAll = true;
+    Table m_tables[2];
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANFILTER_P_H
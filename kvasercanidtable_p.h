@@ -0,0 +1,196 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANIDTABLE_P_H
+#define KVASERCANIDTABLE_P_H
+
+#include <QtCore/qalgorithms.h>
+#include <QtCore/qlist.h>
+
+QT_BEGIN_NAMESPACE
+
+// Flat per identifier table. 11 bit identifiers index a dense array of 2048
+// entries, 29 bit identifiers live in an open addressing hash table with
+// linear probing that is kept at most half full. Both are allocated on the
+// first insertion, so unused formats cost nothing.
+template <typename T>
+class KvaserIdTable
+{
+public:
+    T *find(quint32 frameId, bool extended)
+    {
+        if (!extended) {
+            frameId &= 0x7FF;
+            if (m_standardUsed.isEmpty() || !isStandardUsed(frameId))
+                return nullptr;
+            return &m_standard[frameId];
+        }
+        if (m_extended.isEmpty())
+            return nullptr;
+        const quint32 key = extendedKey(frameId);
+        for (quint32 index = slotIndex(key); ; index = (index + 1) & m_extendedMask) {
+            Slot &slot = m_extended[index];
+            if (slot.key == key)
+                return &slot.value;
+            if (slot.key == 0)
+                return nullptr;
+        }
+    }
+
+    const T *find(quint32 frameId, bool extended) const
+    {
+        return const_cast<KvaserIdTable *>(this)->find(frameId, extended);
+    }
+
+    // Returns the entry of the identifier, default constructing it if needed
+    T &insert(quint32 frameId, bool extended)
+    {
+        if (!extended) {
+            frameId &= 0x7FF;
+            if (m_standardUsed.isEmpty()) {
+                m_standard.resize(2048);
+                m_standardUsed.resize(2048 / 64);
+            }
+            if (!isStandardUsed(frameId)) {
+                m_standardUsed[frameId >> 6] |= quint64(1) << (frameId & 63);
+                m_standard[frameId] = T();
+                ++m_size;
+            }
+            return m_standard[frameId];
+        }
+
+        if ((m_extendedCount + 1) * 2 > m_extended.size())
+            growExtended();
+        const quint32 key = extendedKey(frameId);
+        for (quint32 index = slotIndex(key); ; index = (index + 1) & m_extendedMask) {
+            Slot &slot = m_extended[index];
+            if (slot.key == key)
+                return slot.value;
+            if (slot.key == 0) {
+                slot.key = key;
+                slot.value = T();
+                ++m_extendedCount;
+                ++m_size;
+                return slot.value;
+            }
+        }
+    }
+
+    // Calls function(frameId, extended, entry) for every entry
+    template <typename Function>
+    void forEach(Function function) const
+    {
+        for (int word = 0; word < m_standardUsed.size(); ++word) {
+            for (quint64 bits = m_standardUsed[word]; bits; bits &= bits - 1) {
+                const quint32 frameId = quint32(word * 64) + qCountTrailingZeroBits(bits);
+                function(frameId, false, m_standard[frameId]);
+            }
+        }
+        for (const Slot &slot : m_extended) {
+            if (slot.key != 0)
+                function(slot.key & 0x1FFFFFFF, true, slot.value);
+        }
+    }
+
+    template <typename Function>
+    void forEach(Function function)
+    {
+        for (int word = 0; word < m_standardUsed.size(); ++word) {
+            for (quint64 bits = m_standardUsed[word]; bits; bits &= bits - 1) {
+                const quint32 frameId = quint32(word * 64) + qCountTrailingZeroBits(bits);
+                function(frameId, false, m_standard[frameId]);
+            }
+        }
+        for (Slot &slot : m_extended) {
+            if (slot.key != 0)
+                function(slot.key & 0x1FFFFFFF, true, slot.value);
+        }
+    }
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    void clear()
+    {
+        m_standard.clear();
+        m_standardUsed.clear();
+        m_extended.clear();
+        m_extendedMask = 0;
+        m_extendedCount = 0;
+        m_size = 0;
+    }
+
+private:
+    struct Slot
+    {
+        // Identifier with bit 31 set, 0 marks a free slot
+        quint32 key = 0;
+        T value = T();
+    };
+
+    static quint32 extendedKey(quint32 frameId) { return (frameId & 0x1FFFFFFF) | 0x80000000; }
+    quint32 slotIndex(quint32 key) const { return (key * 0x9E3779B1u) >> 7 & m_extendedMask; }
+    bool isStandardUsed(quint32 frameId) const
+    {
+        return m_standardUsed[frameId >> 6] & (quint64(1) << (frameId & 63));
+    }
+
+    void growExtended()
+    {
+        QList<Slot> oldSlots(qMax(qsizetype(64), m_extended.size() * 2));
+        oldSlots.swap(m_extended);
+        m_extendedMask = quint32(m_extended.size() - 1);
+        for (Slot &slot : oldSlots) {
+            if (slot.key == 0)
+                continue;
+            quint32 index = slotIndex(slot.key);
+            while (m_extended[index].key != 0)
+                index = (index + 1) & m_extendedMask;
+            m_extended[index] = std::move(slot);
+        }
+    }
+
+    QList<T> m_standard;
+    QList<quint64> m_standardUsed;
+    QList<Slot> m_extended;
+    quint32 m_extendedMask = 0;
+    int m_extendedCount = 0;
+    int m_size = 0;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANIDTABLE_P_H
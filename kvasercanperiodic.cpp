@@ -0,0 +1,183 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanperiodic_p.h"
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+void KvaserPeriodicMessage::setPayload(const char *payload, quint32 length)
+{
+    quint64 words[PayloadWords] = {};
+    length = qMin(length, quint32(sizeof(words)));
+    memcpy(words, payload, length);
+
+    const quint32 lock = m_lock.load(std::memory_order_relaxed);
+    m_lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_length.store(length, std::memory_order_relaxed);
+    for (quint32 word = 0; word < (length + 7) / 8; ++word)
+        m_payload[word].store(words[word], std::memory_order_relaxed);
+    m_lock.store(lock + 2, std::memory_order_release);
+}
+
+quint32 KvaserPeriodicMessage::payload(char *buffer) const
+{
+    quint64 words[PayloadWords];
+    quint32 length = 0;
+    for (;;) {
+        const quint32 lock = m_lock.load(std::memory_order_acquire);
+        if (lock & 1)
+            continue;
+        length = qMin(m_length.load(std::memory_order_relaxed), quint32(sizeof(words)));
+        for (quint32 word = 0; word < (length + 7) / 8; ++word)
+            words[word] = m_payload[word].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_lock.load(std::memory_order_relaxed) == lock)
+            break;
+    }
+    memcpy(buffer, words, length);
+    return length;
+}
+
+KvaserPeriodicScheduler::KvaserPeriodicScheduler(WriteFunction write)
+    : m_write(std::move(write))
+{
+}
+
+KvaserPeriodicMessage *KvaserPeriodicScheduler::addMessage(quint32 id, quint32 flags, qint64 period,
+                                                           const char *payload, quint32 length)
+{
+    auto message = std::make_unique<KvaserPeriodicMessage>(id, flags, period);
+    message->setPayload(payload, length);
+    message->m_due = hostMicroSeconds();
+
+    QMutexLocker locker(&m_mutex);
+    m_messages.push_back(std::move(message));
+    m_changed.wakeOne();
+    return m_messages.back().get();
+}
+
+// The scheduler thread frees the message, it may be spinning on it
+void KvaserPeriodicScheduler::removeMessage(KvaserPeriodicMessage *message)
+{
+    QMutexLocker locker(&m_mutex);
+    message->m_removed = true;
+    m_changed.wakeOne();
+}
+
+void KvaserPeriodicScheduler::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        requestInterruption();
+        m_changed.wakeOne();
+    }
+    wait();
+}
+
+// Drops removed messages and returns the one due first, with the mutex held
+KvaserPeriodicMessage *KvaserPeriodicScheduler::nextDue()
+{
+    KvaserPeriodicMessage *next = nullptr;
+    for (size_t index = 0; index < m_messages.size();) {
+        KvaserPeriodicMessage *message = m_messages[index].get();
+        if (message->m_removed) {
+            m_messages[index] = std::move(m_messages.back());
+            m_messages.pop_back();
+            continue;
+        }
+        if (!next || message->m_due < next->m_due)
+            next = message;
+        ++index;
+    }
+    return next;
+}
+
+void KvaserPeriodicScheduler::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!isInterruptionRequested()) {
+        KvaserPeriodicMessage *message = nextDue();
+        if (!message) {
+            m_changed.wait(&m_mutex);
+            continue;
+        }
+
+        // Woken up early whenever a message is added or removed
+        const qint64 due = message->m_due;
+        const qint64 sleep = due - hostMicroSeconds() - spinMicroSeconds;
+        if (sleep > 0) {
+            m_changed.wait(&m_mutex, (unsigned long)qMax(sleep / 1000, qint64(1)));
+            continue;
+        }
+
+        locker.unlock();
+        qint64 now = hostMicroSeconds();
+        while (now < due && !isInterruptionRequested())
+            now = hostMicroSeconds();
+        locker.relock();
+
+        if (!message->m_removed && !isInterruptionRequested())
+            transmit(message, now);
+    }
+}
+
+// Called with the mutex held, so that a removed message is never sent
+void KvaserPeriodicScheduler::transmit(KvaserPeriodicMessage *message, qint64 now)
+{
+    char payload[64];
+    const quint32 length = message->payload(payload);
+    const KvaserStatus result = m_write(message->m_id, payload, length, message->m_flags);
+    if (result == KvaserStatus::OK) {
+        m_frames.add(1);
+        m_errors.record((now - message->m_due) * 1000);
+    } else if (result == KvaserStatus::TransmitBufferOverflow) {
+        m_transmitBufferFull.add(1);
+    } else {
+        m_writeFailures.add(1);
+    }
+
+    message->m_due += message->m_period;
+    if (message->m_due <= now) {
+        const qint64 missed = (now - message->m_due) / message->m_period + 1;
+        m_missedPeriods.add(quint64(missed));
+        message->m_due += missed * message->m_period;
+    }
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,142 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANPERIODIC_P_H
+#define KVASERCANPERIODIC_P_H
+
+#include "kvasercancommon_p.h"
+
+#include <QtCore/qmutex.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qwaitcondition.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+QT_BEGIN_NAMESPACE
+
+// Message transmitted by KvaserPeriodicScheduler. flags are CANLIB
+// canMSG_* and canFDMSG_* bits, period is in microseconds. The payload is
+// a sequence lock with relaxed atomic fields: one thread replaces it while
+// the scheduler reads, and a transmission never mixes old and new bytes.
+class KvaserPeriodicMessage
+{
+public:
+    KvaserPeriodicMessage(quint32 id, quint32 flags, qint64 period)
+        : m_id(id), m_flags(flags), m_period(period)
+    {
+    }
+
+    quint32 id() const { return m_id; }
+    quint32 flags() const { return m_flags; }
+    qint64 period() const { return m_period; }
+
+    // Only one thread may set the payload
+    void setPayload(const char *payload, quint32 length);
+    // Returns the length of the payload copied to buffer
+    quint32 payload(char *buffer) const;
+
+private:
+    friend class KvaserPeriodicScheduler;
+    static constexpr int PayloadWords = 64 / 8;
+
+    const quint32 m_id;
+    const quint32 m_flags;
+    const qint64 m_period;
+    std::atomic<quint32> m_lock{0};
+    std::atomic<quint32> m_length{0};
+    std::atomic<quint64> m_payload[PayloadWords] = {};
+    // Guarded by the scheduler mutex
+    qint64 m_due = 0;
+    bool m_removed = false;
+};
+
+// Transmits periodic messages for channels without periodic object buffers.
+// The thread sleeps until shortly before the next message is due and spins
+// on the host clock for the rest. The messages are kept in a plain list:
+// for a few dozen of them a scan for the next due one is cheaper than
+// keeping a heap in order. A late transmission does not shift the
+// schedule, periods that passed completely are skipped and counted.
+class KvaserPeriodicScheduler : public QThread
+{
+public:
+    using WriteFunction = std::function<KvaserStatus(quint32 id, const char *payload, quint32 length,
+                                                     quint32 flags)>;
+
+    explicit KvaserPeriodicScheduler(WriteFunction write);
+
+    // The message is first transmitted right away. It is owned by the
+    // scheduler and stays valid until removeMessage() returns, after which
+    // it is never transmitted again.
+    KvaserPeriodicMessage *addMessage(quint32 id, quint32 flags, qint64 period,
+                                      const char *payload, quint32 length);
+    void removeMessage(KvaserPeriodicMessage *message);
+    void stop();
+
+    // Readable from any thread
+    quint64 frames() const { return m_frames.load(); }
+    quint64 transmitBufferFull() const { return m_transmitBufferFull.load(); }
+    quint64 writeFailures() const { return m_writeFailures.load(); }
+    quint64 missedPeriods() const { return m_missedPeriods.load(); }
+    // Transmission time minus due time in nanoseconds
+    const KvaserLatencyHistogram &errors() const { return m_errors; }
+
+protected:
+    void run() override;
+
+private:
+    // Spinning starts this long before a message is due
+    static constexpr qint64 spinMicroSeconds = 1000;
+
+    KvaserPeriodicMessage *nextDue();
+    void transmit(KvaserPeriodicMessage *message, qint64 now);
+
+    WriteFunction m_write;
+    QMutex m_mutex;
+    QWaitCondition m_changed;
+    std::vector<std::unique_ptr<KvaserPeriodicMessage>> m_messages;
+    KvaserCounter m_frames;
+    KvaserCounter m_transmitBufferFull;
+    KvaserCounter m_writeFailures;
+    KvaserCounter m_missedPeriods;
+    KvaserLatencyHistogram m_errors;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANPERIODIC_P_H
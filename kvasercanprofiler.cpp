@@ -0,0 +1,136 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanprofiler_p.h"
+
+#include <algorithm>
+#include <cmath>
+
+QT_BEGIN_NAMESPACE
+
+// Frame lengths follow ISO 11898-1. Dynamic stuff bits are counted for the
+// worst case of one per four bits of the stuffed region; CAN FD adds the
+// fixed stuff bits of the CRC field instead. The 3 bit interframe space is
+// included, so back to back frames add up to the bus time.
+void KvaserTrafficProfiler::wireBits(bool extended, quint32 payloadSize, bool canFd, bool bitrateSwitch,
+                                     quint32 *nominalBits, quint32 *dataBits)
+{
+    const quint32 payloadBits = payloadSize * 8;
+
+    if (!canFd) {
+        // SOF, identifier, control and data up to the CRC are stuffed
+        const quint32 stuffed = (extended ? 54 : 34) + payloadBits;
+        // CRC delimiter, ACK slot and delimiter, EOF and interframe space
+        *nominalBits = stuffed + (stuffed - 1) / 4 + 13;
+        *dataBits = 0;
+        return;
+    }
+
+    // Arbitration phase up to and including BRS
+    const quint32 arbitration = extended ? 36 : 17;
+    // ESI, DLC, data, stuff count with parity and CRC, both preceded by a
+    // fixed stuff bit every 4 bits, and the CRC delimiter
+    const quint32 crcBits = payloadSize > 16 ? 21 : 17;
+    const quint32 data = 1 + 4 + payloadBits + 4 + crcBits + (4 + crcBits) / 4 + 1 + 1;
+    const quint32 dynamicStuff = (arbitration + 5 + payloadBits - 1) / 4;
+    const quint32 arbitrationStuff = (arbitration - 1) / 4;
+    // ACK slot and delimiter, EOF and interframe space
+    const quint32 trailer = 12;
+
+    if (bitrateSwitch) {
+        *nominalBits = arbitration + arbitrationStuff + trailer;
+        *dataBits = data + dynamicStuff - arbitrationStuff;
+    } else {
+        *nominalBits = arbitration + data + dynamicStuff + trailer;
+        *dataBits = 0;
+    }
+}
+
+QList<KvaserTrafficEntry> KvaserTrafficProfiler::report(quint32 bitRate, quint32 dataBitRate) const
+{
+    const double nominalBitTime = bitRate ? 1.0 / double(bitRate) : 0.0;
+    const double dataBitTime = dataBitRate ? 1.0 / double(dataBitRate) : nominalBitTime;
+
+    QList<KvaserTrafficEntry> entries;
+    entries.reserve(m_entries.size());
+    double totalBusTime = 0.0;
+    m_entries.forEach([&](quint32 frameId, bool extended, const Entry &entry) {
+        KvaserTrafficEntry &result = entries.emplaceBack();
+        result.frameId = frameId;
+        result.extendedFrameFormat = extended;
+        result.frames = entry.frames;
+        result.bytes = entry.bytes;
+        result.nominalBits = entry.nominalBits;
+        result.dataBits = entry.dataBits;
+        result.busTime = double(entry.nominalBits) * nominalBitTime + double(entry.dataBits) * dataBitTime;
+        result.meanPeriod = entry.meanPeriod;
+        if (entry.periods > 0)
+            result.periodJitter = std::sqrt(entry.periodM2 / double(entry.periods));
+        if (entry.lastTime > entry.firstTime)
+            result.framesPerSecond = double(entry.periods) * 1e6 / double(entry.lastTime - entry.firstTime);
+        totalBusTime += result.busTime;
+    });
+
+    for (KvaserTrafficEntry &entry : entries)
+        entry.busTimeShare = totalBusTime > 0.0 ? entry.busTime / totalBusTime : 0.0;
+
+    std::sort(entries.begin(), entries.end(), [](const KvaserTrafficEntry &a, const KvaserTrafficEntry &b) {
+        if (a.busTime != b.busTime)
+            return a.busTime > b.busTime;
+        if (a.extendedFrameFormat != b.extendedFrameFormat)
+            return b.extendedFrameFormat;
+        return a.frameId < b.frameId;
+    });
+    return entries;
+}
+
+QString KvaserTrafficProfiler::format(const QList<KvaserTrafficEntry> &entries)
+{
+    QString report;
+    for (const KvaserTrafficEntry &entry : entries) {
+        report += QStringLiteral("%1: frames %2, bytes %3, share %4 %, rate %5/s, period %6 us, jitter %7 us\n")
+                .arg(entry.frameId, entry.extendedFrameFormat ? 8 : 3, 16, QLatin1Char('0'))
+                .arg(entry.frames)
+                .arg(entry.bytes)
+                .arg(entry.busTimeShare * 100.0, 0, 'f', 2)
+                .arg(entry.framesPerSecond, 0, 'f', 1)
+                .arg(entry.meanPeriod, 0, 'f', 1)
+                .arg(entry.periodJitter, 0, 'f', 1);
+    }
+    return report;
+}
+
+QT_END_NAMESPACE
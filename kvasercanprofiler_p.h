@@ -0,0 +1,123 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANPROFILER_P_H
+#define KVASERCANPROFILER_P_H
+
+#include "kvasercanidtable_p.h"
+
+#include <QtCore/qlist.h>
+#include <QtCore/qstring.h>
+
+QT_BEGIN_NAMESPACE
+
+// Traffic of one identifier as reported by KvaserTrafficProfiler. Periods
+// and jitter (standard deviation of the period) are in microseconds.
+struct KvaserTrafficEntry
+{
+    quint32 frameId = 0;
+    bool extendedFrameFormat = false;
+    quint64 frames = 0;
+    quint64 bytes = 0;
+    // Estimated bits on the wire including worst case stuffing, split into
+    // bits sent at the nominal and at the data bit rate.
+    quint64 nominalBits = 0;
+    quint64 dataBits = 0;
+    double busTime = 0.0; // seconds
+    double busTimeShare = 0.0;
+    double framesPerSecond = 0.0;
+    double meanPeriod = 0.0;
+    double periodJitter = 0.0;
+};
+
+// Per identifier traffic statistics of the received frames, updated with
+// constant work per frame. Not thread safe, used from the thread that
+// drains the channel.
+class KvaserTrafficProfiler
+{
+public:
+    void record(quint32 frameId, bool extended, bool remote, bool canFd, bool bitrateSwitch,
+                quint32 payloadSize, qint64 timeMicroSeconds)
+    {
+        Entry &entry = m_entries.insert(frameId, extended);
+        quint32 nominalBits = 0;
+        quint32 dataBits = 0;
+        wireBits(extended, remote ? 0 : payloadSize, canFd, bitrateSwitch, &nominalBits, &dataBits);
+        entry.nominalBits += nominalBits;
+        entry.dataBits += dataBits;
+        entry.bytes += remote ? 0 : payloadSize;
+
+        if (entry.frames++ == 0) {
+            entry.firstTime = timeMicroSeconds;
+        } else {
+            // Welford's online mean and variance of the period
+            const double period = double(timeMicroSeconds - entry.lastTime);
+            ++entry.periods;
+            const double delta = period - entry.meanPeriod;
+            entry.meanPeriod += delta / double(entry.periods);
+            entry.periodM2 += delta * (period - entry.meanPeriod);
+        }
+        entry.lastTime = timeMicroSeconds;
+    }
+
+    // Sorted by descending bus time, the bit rates convert bits into time
+    QList<KvaserTrafficEntry> report(quint32 bitRate, quint32 dataBitRate) const;
+    static QString format(const QList<KvaserTrafficEntry> &entries);
+    void clear() { m_entries.clear(); }
+
+    static void wireBits(bool extended, quint32 payloadSize, bool canFd, bool bitrateSwitch,
+                         quint32 *nominalBits, quint32 *dataBits);
+
+private:
+    struct Entry
+    {
+        quint64 frames = 0;
+        quint64 bytes = 0;
+        quint64 nominalBits = 0;
+        quint64 dataBits = 0;
+        qint64 firstTime = 0;
+        qint64 lastTime = 0;
+        quint64 periods = 0;
+        double meanPeriod = 0.0;
+        double periodM2 = 0.0;
+    };
+
+    KvaserIdTable<Entry> m_entries;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANPROFILER_P_H
@@ -0,0 +1,493 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanreplay_p.h"
+#include "kvasercancapture_p.h"
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qlist.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool parseHex(const char *text, int size, quint32 *value)
+{
+    if (size <= 0 || size > 8)
+        return false;
+    quint32 result = 0;
+    for (int i = 0; i < size; ++i) {
+        const int digit = hexValue(text[i]);
+        if (digit < 0)
+            return false;
+        result = (result << 4) | quint32(digit);
+    }
+    *value = result;
+    return true;
+}
+
+// Hex digit pairs without separators, as in candump logs
+bool parseHexPayload(const char *text, int size, KvaserReplayFrame *frame)
+{
+    if (size % 2 || size / 2 > int(sizeof(frame->payload)))
+        return false;
+    for (int i = 0; i < size; i += 2) {
+        const int high = hexValue(text[i]);
+        const int low = hexValue(text[i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        frame->payload[i / 2] = char(high << 4 | low);
+    }
+    frame->length = quint32(size / 2);
+    return true;
+}
+
+// Seconds with up to 6 decimals into microseconds, without the rounding
+// of a double for absolute Unix times
+bool parseSeconds(const QByteArray &text, qint64 *microSeconds)
+{
+    const int dot = text.indexOf('.');
+    bool ok = false;
+    const qint64 seconds = (dot < 0 ? text : text.left(dot)).toLongLong(&ok);
+    if (!ok || seconds < 0)
+        return false;
+    qint64 fraction = 0;
+    if (dot >= 0) {
+        QByteArray digits = text.mid(dot + 1).left(6);
+        if (digits.isEmpty())
+            return false;
+        fraction = digits.toLongLong(&ok);
+        if (!ok || fraction < 0)
+            return false;
+        for (int i = int(digits.size()); i < 6; ++i)
+            fraction *= 10;
+    }
+    *microSeconds = seconds * 1000000 + fraction;
+    return true;
+}
+
+QList<QByteArray> tokenize(const QByteArray &line)
+{
+    QList<QByteArray> tokens = line.simplified().split(' ');
+    if (tokens.size() == 1 && tokens.first().isEmpty())
+        tokens.clear();
+    return tokens;
+}
+
+// Plays back the frame records of a capture file written by
+// KvaserCaptureWriter
+class KvaserCaptureTraceReader : public KvaserTraceReader
+{
+public:
+    ~KvaserCaptureTraceReader() override
+    {
+        if (m_data)
+            m_file.unmap(m_data);
+    }
+
+    bool open(const QString &path, QString *errorString)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            *errorString = m_file.errorString();
+            return false;
+        }
+        m_size = m_file.size();
+        m_data = m_size >= qint64(sizeof(KvaserCaptureFileHeader)) ? m_file.map(0, m_size) : nullptr;
+        if (!m_data) {
+            *errorString = QObject::tr("Cannot map capture file");
+            return false;
+        }
+        KvaserCaptureFileHeader header;
+        memcpy(&header, m_data, sizeof(header));
+        if (memcmp(header.magic, "KVCAPTR", 8) != 0 || header.byteOrder != 0x01020304
+                || header.version != 1) {
+            *errorString = QObject::tr("Unsupported capture file");
+            return false;
+        }
+        m_offset = header.headerSize;
+        m_end = qMin(qint64(header.dataEnd), m_size);
+        return true;
+    }
+
+    bool next(KvaserReplayFrame *frame) override
+    {
+        while (m_offset + qint64(sizeof(KvaserCaptureFrameRecord)) <= m_end) {
+            KvaserCaptureFrameRecord record;
+            memcpy(&record, m_data + m_offset, sizeof(record));
+            if (record.size < 4 || m_offset + record.size > m_end)
+                return false;
+            const qint64 offset = m_offset;
+            m_offset += record.size;
+            if (record.type != KvaserCaptureFrameType)
+                continue;
+            // A truncated or corrupt record must not be read beyond its size
+            if (record.size < sizeof(record) || sizeof(record) + record.length > record.size) {
+                ++m_skipped;
+                continue;
+            }
+            if (record.flags & KVASER_MESSAGE_ERROR_FRAME || record.length > sizeof(frame->payload)) {
+                ++m_skipped;
+                continue;
+            }
+            frame->id = record.id;
+            frame->flags = record.flags;
+            frame->dlc = record.dlc;
+            frame->length = record.length;
+            frame->timestamp = record.timestamp;
+            memcpy(frame->payload, m_data + offset + sizeof(record), record.length);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    QFile m_file;
+    uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_offset = 0;
+    qint64 m_end = 0;
+};
+
+class KvaserTextTraceReader : public KvaserTraceReader
+{
+public:
+    bool open(const QString &path, QString *errorString)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            *errorString = m_file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    bool next(KvaserReplayFrame *frame) override
+    {
+        while (!m_file.atEnd()) {
+            if (parseLine(m_file.readLine(), frame))
+                return true;
+        }
+        return false;
+    }
+
+protected:
+    // Returns false for lines without a frame, counting malformed ones
+    virtual bool parseLine(const QByteArray &line, KvaserReplayFrame *frame) = 0;
+
+private:
+    QFile m_file;
+};
+
+// candump -L format: "(1436509052.249713) can0 123#DEADBEEF", with 8 digit
+// extended identifiers, "123#R" remote requests, "123#1122_B" classic DLCs
+// above 8 and "123##1DEADBEEF" CAN FD frames whose first digit holds the
+// BRS (1) and ESI (2) flags.
+class KvaserCandumpTraceReader : public KvaserTextTraceReader
+{
+protected:
+    bool parseLine(const QByteArray &line, KvaserReplayFrame *frame) override
+    {
+        const QList<QByteArray> tokens = tokenize(line);
+        if (tokens.size() < 3 || !tokens.at(0).startsWith('('))
+            return false;
+
+        const QByteArray time = tokens.at(0).mid(1, tokens.at(0).size() - 2);
+        const QByteArray &text = tokens.at(2);
+        const int hash = text.indexOf('#');
+        quint32 id = 0;
+        if (!parseSeconds(time, &frame->timestamp) || hash < 0 || !parseHex(text.constData(), hash, &id)) {
+            ++m_skipped;
+            return false;
+        }
+        // CAN_ERR_FLAG
+        if (hash == 8 && (id & 0x20000000)) {
+            ++m_skipped;
+            return false;
+        }
+
+        frame->id = id & 0x1FFFFFFF;
+        frame->flags = hash == 8 ? KVASER_MESSAGE_EXTENDED_FRAME_FORMAT : KVASER_MESSAGE_STANDARD_FRAME_FORMAT;
+        const char *data = text.constData() + hash + 1;
+        int size = int(text.size()) - hash - 1;
+
+        if (size > 0 && data[0] == '#') {
+            const int fdFlags = size > 1 ? hexValue(data[1]) : -1;
+            if (fdFlags < 0 || !parseHexPayload(data + 2, size - 2, frame)) {
+                ++m_skipped;
+                return false;
+            }
+            frame->flags |= KVASER_MESSAGE_CANFD;
+            if (fdFlags & 1)
+                frame->flags |= KVASER_MESSAGE_BIT_RATE_SWITCH;
+            frame->dlc = frame->length;
+            return true;
+        }
+
+        if (size > 0 && (data[0] == 'R' || data[0] == 'r')) {
+            frame->flags |= KVASER_MESSAGE_REMOTE_REQUEST;
+            frame->length = 0;
+            frame->dlc = size > 1 ? quint32(qMax(hexValue(data[1]), 0)) : 0;
+            return true;
+        }
+
+        int dlc = -1;
+        const int underscore = text.indexOf('_', hash + 1);
+        if (underscore >= 0) {
+            dlc = underscore + 1 < text.size() ? hexValue(text.at(underscore + 1)) : -1;
+            size = underscore - hash - 1;
+            if (dlc < 0) {
+                ++m_skipped;
+                return false;
+            }
+        }
+        if (!parseHexPayload(data, size, frame) || frame->length > 8) {
+            ++m_skipped;
+            return false;
+        }
+        frame->dlc = dlc >= 0 ? quint32(dlc) : frame->length;
+        return true;
+    }
+};
+
+// Vector ASC format, classic lines like
+// "1.234567 1 123x Rx d 8 01 02 03 04 05 06 07 08" and CAN FD lines like
+// "2.000000 CANFD 1 Rx 123x Name 1 0 9 12 01 02 ...", where the symbolic
+// name is optional. Identifiers and data are hexadecimal unless the file
+// header says "base dec".
+class KvaserAscTraceReader : public KvaserTextTraceReader
+{
+protected:
+    bool parseLine(const QByteArray &line, KvaserReplayFrame *frame) override
+    {
+        const QList<QByteArray> tokens = tokenize(line);
+        if (tokens.size() >= 2 && tokens.at(0) == "base")
+            m_base = tokens.at(1) == "dec" ? 10 : 16;
+        if (tokens.size() < 4 || !parseSeconds(tokens.at(0), &frame->timestamp))
+            return false;
+
+        if (tokens.at(1) == "CANFD")
+            return parseCanFd(tokens, frame);
+
+        // Only frame lines have a direction
+        if (tokens.size() < 5 || (tokens.at(3) != "Rx" && tokens.at(3) != "Tx"))
+            return false;
+        if (!parseId(tokens.at(2), frame)) {
+            ++m_skipped;
+            return false;
+        }
+        bool ok = false;
+        if (tokens.at(4) == "r") {
+            frame->flags |= KVASER_MESSAGE_REMOTE_REQUEST;
+            frame->dlc = tokens.size() > 5 ? tokens.at(5).toUInt(&ok, 16) : 0;
+            frame->length = 0;
+            return true;
+        }
+        frame->dlc = tokens.size() > 5 ? tokens.at(5).toUInt(&ok, 16) : 0;
+        if (tokens.at(4) != "d" || !ok || frame->dlc > 15
+                || !parseBytes(tokens, 6, qMin(frame->dlc, 8u), frame)) {
+            ++m_skipped;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool parseCanFd(const QList<QByteArray> &tokens, KvaserReplayFrame *frame)
+    {
+        if (tokens.size() < 9 || (tokens.at(3) != "Rx" && tokens.at(3) != "Tx"))
+            return false;
+        if (!parseId(tokens.at(4), frame)) {
+            ++m_skipped;
+            return false;
+        }
+        int index = 5;
+        if (tokens.at(index) != "0" && tokens.at(index) != "1")
+            ++index;
+        if (index + 3 >= tokens.size()) {
+            ++m_skipped;
+            return false;
+        }
+        bool dlcOk = false;
+        bool lengthOk = false;
+        const bool bitrateSwitch = tokens.at(index) == "1";
+        const quint32 length = tokens.at(index + 3).toUInt(&lengthOk);
+        tokens.at(index + 2).toUInt(&dlcOk, 16);
+        if (!dlcOk || !lengthOk || length > 64 || !parseBytes(tokens, index + 4, length, frame)) {
+            ++m_skipped;
+            return false;
+        }
+        frame->flags |= KVASER_MESSAGE_CANFD;
+        if (bitrateSwitch)
+            frame->flags |= KVASER_MESSAGE_BIT_RATE_SWITCH;
+        frame->dlc = length;
+        return true;
+    }
+
+    bool parseId(QByteArray text, KvaserReplayFrame *frame)
+    {
+        frame->flags = KVASER_MESSAGE_STANDARD_FRAME_FORMAT;
+        if (text.endsWith('x')) {
+            text.chop(1);
+            frame->flags = KVASER_MESSAGE_EXTENDED_FRAME_FORMAT;
+        }
+        bool ok = false;
+        frame->id = text.toUInt(&ok, m_base);
+        return ok && frame->id <= 0x1FFFFFFF;
+    }
+
+    bool parseBytes(const QList<QByteArray> &tokens, int first, quint32 count, KvaserReplayFrame *frame)
+    {
+        if (first + int(count) > tokens.size())
+            return false;
+        for (quint32 i = 0; i < count; ++i) {
+            bool ok = false;
+            const uint value = tokens.at(first + int(i)).toUInt(&ok, m_base);
+            if (!ok || value > 255)
+                return false;
+            frame->payload[i] = char(value);
+        }
+        frame->length = count;
+        return true;
+    }
+
+    int m_base = 16;
+};
+
+} // namespace
+
+std::unique_ptr<KvaserTraceReader> KvaserTraceReader::open(const QString &path, QString *errorString)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return nullptr;
+    }
+    const QByteArray magic = file.read(8);
+    file.close();
+
+    if (magic == QByteArray("KVCAPTR", 8)) {
+        auto reader = std::make_unique<KvaserCaptureTraceReader>();
+        if (!reader->open(path, errorString))
+            return nullptr;
+        return reader;
+    }
+
+    std::unique_ptr<KvaserTextTraceReader> reader;
+    if (QFileInfo(path).suffix().compare(QLatin1String("asc"), Qt::CaseInsensitive) == 0)
+        reader = std::make_unique<KvaserAscTraceReader>();
+    else
+        reader = std::make_unique<KvaserCandumpTraceReader>();
+    if (!reader->open(path, errorString))
+        return nullptr;
+    return reader;
+}
+
+KvaserReplayThread::KvaserReplayThread(std::unique_ptr<KvaserTraceReader> reader, double speed,
+                                       WriteFunction write, ClockFunction clock,
+                                       std::function<void()> finished)
+    : m_reader(std::move(reader)), m_speed(speed), m_write(std::move(write)),
+      m_clock(std::move(clock)), m_finished(std::move(finished))
+{
+}
+
+void KvaserReplayThread::run()
+{
+    KvaserReplayFrame frame;
+    bool started = false;
+    qint64 traceStart = 0;
+    qint64 deviceStart = 0;
+    quint64 skipped = 0;
+
+    while (!isInterruptionRequested() && m_reader->next(&frame)) {
+        if (m_reader->skipped() != skipped) {
+            m_skipped.add(m_reader->skipped() - skipped);
+            skipped = m_reader->skipped();
+        }
+        if (!started) {
+            traceStart = frame.timestamp;
+            deviceStart = m_clock();
+            started = true;
+        }
+        const qint64 due = deviceStart + qint64(double(frame.timestamp - traceStart) / m_speed);
+
+        // Sleep in slices, so that stopping does not wait for a long gap
+        for (qint64 now = m_clock(); due - now > spinMicroSeconds; now = m_clock()) {
+            if (isInterruptionRequested())
+                break;
+            QThread::usleep(quint64(qMin(due - now - spinMicroSeconds, qint64(100000))));
+        }
+        if (isInterruptionRequested())
+            break;
+        while (m_clock() < due) {
+        }
+
+        KvaserStatus result = m_write(frame);
+        while (result == KvaserStatus::TransmitBufferOverflow && !isInterruptionRequested()) {
+            m_transmitBufferFull.add(1);
+            QThread::yieldCurrentThread();
+            result = m_write(frame);
+        }
+        if (result != KvaserStatus::OK) {
+            m_writeFailures.add(1);
+            continue;
+        }
+
+        // Measured when the frame has been handed to the driver
+        const qint64 error = (m_clock() - due) * 1000;
+        m_frames.add(1);
+        m_errorSum.store(m_errorSum.load(std::memory_order_relaxed) + error, std::memory_order_relaxed);
+        m_errors.record(qAbs(error));
+    }
+    if (m_reader->skipped() != skipped)
+        m_skipped.add(m_reader->skipped() - skipped);
+
+    m_finished();
+}
+
+QT_END_NAMESPACE
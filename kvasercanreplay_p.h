@@ -0,0 +1,138 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANREPLAY_P_H
+#define KVASERCANREPLAY_P_H
+
+#include "kvasercancommon_p.h"
+
+#include <QtCore/qfile.h>
+#include <QtCore/qstring.h>
+#include <QtCore/qthread.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+QT_BEGIN_NAMESPACE
+
+// One frame of a trace. flags are CANLIB canMSG_* and canFDMSG_* bits and
+// dlc is passed to canWrite() as is, timestamp is in microseconds.
+struct KvaserReplayFrame
+{
+    quint32 id = 0;
+    quint32 flags = 0;
+    quint32 dlc = 0;
+    quint32 length = 0;
+    qint64 timestamp = 0;
+    char payload[64];
+};
+
+// Streams the frames of a recorded trace. Lines or records that cannot be
+// replayed, like error frames or malformed text, are skipped and counted.
+class KvaserTraceReader
+{
+public:
+    virtual ~KvaserTraceReader() = default;
+    virtual bool next(KvaserReplayFrame *frame) = 0;
+    quint64 skipped() const { return m_skipped; }
+
+    // Opens a capture file of this plugin, a Vector ASC file (.asc) or a
+    // candump log file (anything else)
+    static std::unique_ptr<KvaserTraceReader> open(const QString &path, QString *errorString);
+
+protected:
+    quint64 m_skipped = 0;
+};
+
+// Transmits a trace with its original timing. Every frame is due at the
+// device timer value of the replay start plus its trace time divided by
+// the speed. The thread sleeps until shortly before that and spins on the
+// device timer for the rest, so the scheduler wakeup latency does not end
+// up in the timing.
+class KvaserReplayThread : public QThread
+{
+public:
+    using WriteFunction = std::function<KvaserStatus(const KvaserReplayFrame &)>;
+    // Device timer in microseconds
+    using ClockFunction = std::function<qint64()>;
+
+    KvaserReplayThread(std::unique_ptr<KvaserTraceReader> reader, double speed,
+                       WriteFunction write, ClockFunction clock, std::function<void()> finished);
+
+    void stop()
+    {
+        requestInterruption();
+        wait();
+    }
+
+    // Readable from any thread
+    quint64 frames() const { return m_frames.load(); }
+    quint64 skipped() const { return m_skipped.load(); }
+    quint64 transmitBufferFull() const { return m_transmitBufferFull.load(); }
+    quint64 writeFailures() const { return m_writeFailures.load(); }
+    // Signed mean of the transmit time minus the due time, microseconds
+    double meanError() const
+    {
+        const quint64 count = m_frames.load();
+        return count ? double(m_errorSum.load(std::memory_order_relaxed)) / double(count) / 1000.0 : 0.0;
+    }
+    // Absolute timing errors in nanoseconds
+    const KvaserLatencyHistogram &errors() const { return m_errors; }
+
+protected:
+    void run() override;
+
+private:
+    // Spinning starts this long before a frame is due
+    static constexpr qint64 spinMicroSeconds = 2000;
+
+    std::unique_ptr<KvaserTraceReader> m_reader;
+    double m_speed;
+    WriteFunction m_write;
+    ClockFunction m_clock;
+    std::function<void()> m_finished;
+    KvaserCounter m_frames;
+    KvaserCounter m_skipped;
+    KvaserCounter m_transmitBufferFull;
+    KvaserCounter m_writeFailures;
+    std::atomic<qint64> m_errorSum{0};
+    KvaserLatencyHistogram m_errors;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANREPLAY_P_H
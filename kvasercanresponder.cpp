@@ -0,0 +1,107 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanresponder_p.h"
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+void KvaserAutoResponder::insert(quint32 frameId, quint32 flags, const char *payload, quint32 length)
+{
+    QMutexLocker locker(&m_mutex);
+    Response &response = m_table.insert(frameId, flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
+    if (!response.active)
+        m_size.fetch_add(1, std::memory_order_release);
+    response.active = true;
+    response.flags = flags;
+    response.length = qMin(length, quint32(sizeof(response.payload)));
+    memcpy(response.payload, payload, response.length);
+}
+
+void KvaserAutoResponder::setPayload(quint32 frameId, bool extended, const char *payload, quint32 length)
+{
+    QMutexLocker locker(&m_mutex);
+    Response *response = m_table.find(frameId, extended);
+    if (!response || !response->active)
+        return;
+    response->length = qMin(length, quint32(sizeof(response->payload)));
+    memcpy(response->payload, payload, response->length);
+}
+
+// The table cannot shrink, a removed response stays as an inactive entry
+void KvaserAutoResponder::remove(quint32 frameId, bool extended)
+{
+    QMutexLocker locker(&m_mutex);
+    Response *response = m_table.find(frameId, extended);
+    if (!response || !response->active)
+        return;
+    response->active = false;
+    if (m_size.fetch_sub(1, std::memory_order_release) == 1)
+        m_table.clear();
+}
+
+void KvaserAutoResponder::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_table.clear();
+    m_size.store(0, std::memory_order_release);
+}
+
+void KvaserAutoResponder::respond(long id, quint32 flags, const WriteFunction &write)
+{
+    // Our own remote requests come back as transmit acknowledgements
+    if (!(flags & KVASER_MESSAGE_REMOTE_REQUEST) || (flags & KVASER_MESSAGE_TRANSMIT_ACKNOWLEDGE) || isEmpty())
+        return;
+
+    Response response;
+    {
+        QMutexLocker locker(&m_mutex);
+        const Response *entry = m_table.find(quint32(id), flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
+        if (!entry || !entry->active)
+            return;
+        response = *entry;
+    }
+
+    const bool written = write(quint32(id), response.payload, response.length, response.flags) == KvaserStatus::OK;
+    QMutexLocker locker(&m_mutex);
+    if (written)
+        m_responses.add(1);
+    else
+        m_failures.add(1);
+}
+
+QT_END_NAMESPACE
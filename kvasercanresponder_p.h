@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANRESPONDER_P_H
+#define KVASERCANRESPONDER_P_H
+
+#include "kvasercancommon_p.h"
+#include "kvasercanidtable_p.h"
+
+#include <QtCore/qmutex.h>
+
+#include <atomic>
+#include <functional>
+
+QT_BEGIN_NAMESPACE
+
+// Answers remote request frames in software for devices without auto
+// response object buffers. respond() runs in the receive path, on the
+// receive thread if there is one, before the frame is handed to Qt, and
+// writes through the handle of that thread. Only remote request frames
+// look at the table, so the mutex guarding it costs nothing for ordinary
+// traffic. The response is copied out of the table and written without
+// the mutex held, changing the table never waits for the driver.
+class KvaserAutoResponder
+{
+public:
+    using WriteFunction = std::function<KvaserStatus(quint32 id, const char *payload, quint32 length,
+                                                     quint32 flags)>;
+
+    // flags are the CANLIB canMSG_* bits of the response, which answers
+    // remote requests for its identifier and format
+    void insert(quint32 frameId, quint32 flags, const char *payload, quint32 length);
+    void setPayload(quint32 frameId, bool extended, const char *payload, quint32 length);
+    void remove(quint32 frameId, bool extended);
+    void clear();
+    bool isEmpty() const { return m_size.load(std::memory_order_acquire) == 0; }
+
+    // Sends the response to a received message with write if it is a
+    // remote request for an identifier with a response. Safe to call from
+    // any thread.
+    void respond(long id, quint32 flags, const WriteFunction &write);
+
+    // Readable from any thread
+    quint64 responses() const { return m_responses.load(); }
+    quint64 failures() const { return m_failures.load(); }
+
+private:
+    struct Response
+    {
+        bool active = false;
+        quint32 flags = 0;
+        quint32 length = 0;
+        char payload[64];
+    };
+
+    QMutex m_mutex;
+    KvaserIdTable<Response> m_table;
+    std::atomic<int> m_size{0};
+    // Written with the mutex held
+    KvaserCounter m_responses;
+    KvaserCounter m_failures;
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANRESPONDER_P_H
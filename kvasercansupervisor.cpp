@@ -0,0 +1,173 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercansupervisor_p.h"
+
+QT_BEGIN_NAMESPACE
+
+void KvaserCycleSupervisor::setMessages(const QList<KvaserSupervisedMessage> &messages)
+{
+    m_entries.clear();
+    m_index.clear();
+    qint64 smallestTolerance = 2000000;
+    for (const KvaserSupervisedMessage &message : messages) {
+        if (message.period <= 0)
+            continue;
+        Entry entry;
+        entry.message = message;
+        entry.period = message.period;
+        entry.tolerance = qMax(message.tolerance, qint64(0));
+        // A later entry for the same identifier replaces the earlier one
+        if (const int *index = m_index.find(message.frameId, message.extendedFrameFormat)) {
+            m_entries[*index] = entry;
+        } else {
+            m_index.insert(message.frameId, message.extendedFrameFormat) = int(m_entries.size());
+            m_entries.append(entry);
+        }
+        smallestTolerance = qMin(smallestTolerance, qMax(entry.tolerance, entry.period / 4));
+    }
+    m_tick = qBound(qint64(1000), smallestTolerance / 2, qint64(1000000));
+    clearWheel();
+}
+
+QList<KvaserSupervisedMessage> KvaserCycleSupervisor::messages() const
+{
+    QList<KvaserSupervisedMessage> messages;
+    messages.reserve(m_entries.size());
+    for (const Entry &entry : m_entries)
+        messages.append(entry.message);
+    return messages;
+}
+
+void KvaserCycleSupervisor::start(qint64 now)
+{
+    clearWheel();
+    m_startTime = now;
+    m_currentTick = 0;
+    for (int index = 0; index < m_entries.size(); ++index) {
+        Entry &entry = m_entries[index];
+        entry.lastSeen = 0;
+        entry.deadline = now + entry.period + entry.tolerance;
+        entry.scheduled = false;
+        schedule(index);
+    }
+}
+
+void KvaserCycleSupervisor::clearWheel()
+{
+    for (auto &level : m_wheel) {
+        for (int &slot : level)
+            slot = -1;
+    }
+}
+
+// Level 0 holds the next 64 ticks. Later deadlines go to the level of the
+// highest 6 bit group in which the expiry tick differs from the current
+// tick, so they are moved down when the current tick reaches that group.
+// Deadlines beyond the top level wait at the end of its current cycle and
+// are rescheduled from there.
+void KvaserCycleSupervisor::schedule(int index)
+{
+    Entry &entry = m_entries[index];
+    // Rounded up, so that an entry never expires before its deadline
+    const qint64 offset = entry.deadline - m_startTime;
+    quint64 expiry = offset > 0 ? quint64((offset + m_tick - 1) / m_tick) : 0;
+    expiry = qMax(expiry, m_currentTick + 1);
+
+    int level = wheelLevel(expiry);
+    if (level >= Levels) {
+        const quint64 cycleEnd = m_currentTick | ((quint64(1) << (LevelBits * Levels)) - 1);
+        expiry = qMax(cycleEnd, m_currentTick + 1);
+        level = wheelLevel(expiry);
+    }
+
+    const int slot = int((expiry >> (LevelBits * level)) & (SlotsPerLevel - 1));
+    entry.next = m_wheel[level][slot];
+    entry.scheduled = true;
+    m_wheel[level][slot] = index;
+}
+
+int KvaserCycleSupervisor::wheelLevel(quint64 expiry) const
+{
+    if (expiry - m_currentTick < SlotsPerLevel)
+        return 0;
+    const quint64 differing = expiry ^ m_currentTick;
+    return (63 - int(qCountLeadingZeroBits(differing))) / LevelBits;
+}
+
+void KvaserCycleSupervisor::advance(qint64 now, QList<KvaserMessageTimeout> *timeouts)
+{
+    if (m_entries.isEmpty())
+        return;
+
+    const quint64 target = now > m_startTime ? quint64((now - m_startTime) / m_tick) : 0;
+    while (m_currentTick < target) {
+        ++m_currentTick;
+        // Move the entries of the higher level slots that begin at this tick
+        // down before expiring level 0
+        for (int level = 1; level < Levels; ++level) {
+            if (m_currentTick & ((quint64(1) << (LevelBits * level)) - 1))
+                break;
+            expireSlot(level, int((m_currentTick >> (LevelBits * level)) & (SlotsPerLevel - 1)), timeouts);
+        }
+        expireSlot(0, int(m_currentTick & (SlotsPerLevel - 1)), timeouts);
+    }
+}
+
+void KvaserCycleSupervisor::expireSlot(int level, int slot, QList<KvaserMessageTimeout> *timeouts)
+{
+    int index = m_wheel[level][slot];
+    m_wheel[level][slot] = -1;
+    const qint64 tickTime = m_startTime + qint64(m_currentTick) * m_tick;
+    while (index >= 0) {
+        Entry &entry = m_entries[index];
+        const int next = entry.next;
+        entry.scheduled = false;
+        if (entry.deadline > tickTime) {
+            // Received in time, or cascading from a higher level
+            schedule(index);
+        } else {
+            KvaserMessageTimeout &timeout = timeouts->emplaceBack();
+            timeout.frameId = entry.message.frameId;
+            timeout.extendedFrameFormat = entry.message.extendedFrameFormat;
+            timeout.lastSeen = entry.lastSeen;
+            timeout.deadline = entry.deadline;
+        }
+        index = next;
+    }
+}
+
+QT_END_NAMESPACE
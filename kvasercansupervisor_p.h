@@ -0,0 +1,137 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANSUPERVISOR_P_H
+#define KVASERCANSUPERVISOR_P_H
+
+#include "kvasercanidtable_p.h"
+
+#include <QtCore/qlist.h>
+#include <QtCore/qmetatype.h>
+
+QT_BEGIN_NAMESPACE
+
+// A periodic message that is expected at least every period + tolerance
+// microseconds.
+struct KvaserSupervisedMessage
+{
+    quint32 frameId = 0;
+    bool extendedFrameFormat = false;
+    qint64 period = 0;
+    qint64 tolerance = 0;
+};
+
+// Reported when a supervised message misses its deadline. lastSeen is the
+// host time of the last reception in microseconds, 0 if never received.
+struct KvaserMessageTimeout
+{
+    quint32 frameId = 0;
+    bool extendedFrameFormat = false;
+    qint64 lastSeen = 0;
+    qint64 deadline = 0;
+};
+
+// Cycle time supervision on a hierarchical timer wheel with 4 levels of 64
+// slots. A received frame only moves the deadline of its entry, the wheel
+// notices the new deadline when the old slot expires and reschedules the
+// entry there. Receiving a frame and advancing one tick therefore cost O(1)
+// regardless of the number of supervised identifiers. Each missing message
+// is reported once until it is received again.
+class KvaserCycleSupervisor
+{
+public:
+    KvaserCycleSupervisor() { clearWheel(); }
+
+    void setMessages(const QList<KvaserSupervisedMessage> &messages);
+    QList<KvaserSupervisedMessage> messages() const;
+    bool isEmpty() const { return m_entries.isEmpty(); }
+    // Wheel resolution in microseconds: half the smallest tolerance, or
+    // of a quarter period if that is larger, kept between 1 ms and 1 s
+    qint64 tickInterval() const { return m_tick; }
+
+    // Restarts all deadlines from the given host time
+    void start(qint64 now);
+
+    void received(quint32 frameId, bool extended, qint64 now)
+    {
+        const int *index = m_index.find(frameId, extended);
+        if (!index)
+            return;
+        Entry &entry = m_entries[*index];
+        entry.lastSeen = now;
+        entry.deadline = now + entry.period + entry.tolerance;
+        if (!entry.scheduled)
+            schedule(*index);
+    }
+
+    // Expires all ticks up to now, appending missed messages to timeouts
+    void advance(qint64 now, QList<KvaserMessageTimeout> *timeouts);
+
+private:
+    static constexpr int LevelBits = 6;
+    static constexpr int Levels = 4;
+    static constexpr int SlotsPerLevel = 1 << LevelBits;
+
+    struct Entry
+    {
+        KvaserSupervisedMessage message;
+        qint64 period = 0;
+        qint64 tolerance = 0;
+        qint64 lastSeen = 0;
+        qint64 deadline = 0;
+        int next = -1;
+        bool scheduled = false;
+    };
+
+    void clearWheel();
+    void schedule(int index);
+    int wheelLevel(quint64 expiry) const;
+    void expireSlot(int level, int slot, QList<KvaserMessageTimeout> *timeouts);
+
+    QList<Entry> m_entries;
+    KvaserIdTable<int> m_index;
+    // Heads of the singly linked entry lists, -1 if empty
+    int m_wheel[Levels][SlotsPerLevel];
+    qint64 m_tick = 1000;
+    qint64 m_startTime = 0;
+    quint64 m_currentTick = 0;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QT_PREPEND_NAMESPACE(KvaserMessageTimeout))
+
+#endif // KVASERCANSUPERVISOR_P_H
@@ -0,0 +1,124 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercantiming_p.h"
+
+#include <QtCore/qmath.h>
+
+QT_BEGIN_NAMESPACE
+
+bool KvaserBitTimingCalculator::calculate(quint32 clockFrequency, quint32 bitRate, double samplePoint,
+                                          const KvaserBitTimingLimits &limits, KvaserBitTiming *timing)
+{
+    if (clockFrequency == 0 || bitRate == 0 || !(samplePoint > 0.0 && samplePoint < 1.0))
+        return false;
+
+    const quint32 minimumQuanta = 1 + limits.minimumTimeSegment1 + limits.minimumTimeSegment2;
+    const quint32 maximumQuanta = 1 + limits.maximumTimeSegment1 + limits.maximumTimeSegment2;
+    double bestError = maximumBitRateError;
+    double bestSamplePointError = 1.0;
+    bool found = false;
+
+    for (quint32 prescaler = limits.minimumPrescaler; prescaler <= limits.maximumPrescaler; ++prescaler) {
+        const double exactQuanta = double(clockFrequency) / (double(prescaler) * double(bitRate));
+        const quint32 quanta = quint32(qRound(exactQuanta));
+        // The quanta per bit only decrease with larger prescalers
+        if (quanta < minimumQuanta)
+            break;
+        if (quanta > maximumQuanta)
+            continue;
+
+        const double achieved = double(clockFrequency) / (double(prescaler) * double(quanta));
+        const double error = qAbs(achieved - double(bitRate)) / double(bitRate);
+        if (error > bestError + 1e-12)
+            continue;
+
+        quint32 timeSegment2 = qBound(limits.minimumTimeSegment2,
+                                      quanta - quint32(qRound(double(quanta) * samplePoint)),
+                                      limits.maximumTimeSegment2);
+        quint32 timeSegment1 = quanta - 1 - timeSegment2;
+        if (timeSegment1 > limits.maximumTimeSegment1) {
+            timeSegment1 = limits.maximumTimeSegment1;
+            timeSegment2 = quanta - 1 - timeSegment1;
+        }
+        if (timeSegment1 < limits.minimumTimeSegment1 || timeSegment2 < limits.minimumTimeSegment2
+                || timeSegment2 > limits.maximumTimeSegment2) {
+            continue;
+        }
+
+        const double achievedSamplePoint = double(1 + timeSegment1) / double(quanta);
+        const double samplePointError = qAbs(achievedSamplePoint - samplePoint);
+        if (found && error > bestError - 1e-12 && samplePointError >= bestSamplePointError - 1e-12)
+            continue;
+
+        found = true;
+        bestError = error;
+        bestSamplePointError = samplePointError;
+        // Phase 1 mirrors phase 2 around the sample point where it can
+        timing->clockFrequency = clockFrequency;
+        timing->prescaler = prescaler;
+        timing->phaseSegment2 = timeSegment2;
+        timing->phaseSegment1 = qMin(timeSegment1, timeSegment2);
+        timing->propagationSegment = timeSegment1 - timing->phaseSegment1;
+        timing->syncJumpWidth = qMin(timeSegment2, limits.maximumSyncJumpWidth);
+        timing->quanta = quanta;
+        timing->requestedBitRate = bitRate;
+        timing->bitRate = achieved;
+        timing->samplePoint = achievedSamplePoint;
+    }
+    return found;
+}
+
+QString KvaserBitTimingCalculator::format(const KvaserBitTiming &timing)
+{
+    if (!timing.isValid())
+        return QString();
+    return QStringLiteral("%1 bit/s (requested %2, error %3 %), sample point %4 %, clock %5 MHz, "
+                          "prescaler %6, %7 quanta: propagation %8, phase1 %9, phase2 %10, sjw %11")
+            .arg(timing.bitRate, 0, 'f', 1)
+            .arg(timing.requestedBitRate)
+            .arg((timing.bitRate - double(timing.requestedBitRate)) * 100.0 / double(timing.requestedBitRate), 0, 'f', 3)
+            .arg(timing.samplePoint * 100.0, 0, 'f', 1)
+            .arg(double(timing.clockFrequency) / 1e6, 0, 'f', 1)
+            .arg(timing.prescaler)
+            .arg(timing.quanta)
+            .arg(timing.propagationSegment)
+            .arg(timing.phaseSegment1)
+            .arg(timing.phaseSegment2)
+            .arg(timing.syncJumpWidth);
+}
+
+QT_END_NAMESPACE
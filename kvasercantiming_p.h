@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef KVASERCANTIMING_P_H
+#define KVASERCANTIMING_P_H
+
+#include <QtCore/qglobal.h>
+#include <QtCore/qstring.h>
+
+QT_BEGIN_NAMESPACE
+
+// Bit timing in time quanta of the CAN controller clock. A bit consists of
+// the sync segment of one quantum, the propagation and phase 1 segments up
+// to the sample point and the phase 2 segment after it.
+struct KvaserBitTiming
+{
+    quint32 clockFrequency = 0;
+    quint32 prescaler = 0;
+    quint32 propagationSegment = 0;
+    quint32 phaseSegment1 = 0;
+    quint32 phaseSegment2 = 0;
+    quint32 syncJumpWidth = 0;
+    // Quanta per bit, including the sync segment
+    quint32 quanta = 0;
+    quint32 requestedBitRate = 0;
+    double bitRate = 0.0;
+    double samplePoint = 0.0;
+
+    bool isValid() const { return quanta != 0; }
+    // tseg1 and tseg2 of canSetBusParams()
+    quint32 timeSegment1() const { return propagationSegment + phaseSegment1; }
+    quint32 timeSegment2() const { return phaseSegment2; }
+};
+
+// Ranges of the register fields, timeSegment1 is propagation plus phase 1
+struct KvaserBitTimingLimits
+{
+    quint32 minimumPrescaler;
+    quint32 maximumPrescaler;
+    quint32 minimumTimeSegment1;
+    quint32 maximumTimeSegment1;
+    quint32 minimumTimeSegment2;
+    quint32 maximumTimeSegment2;
+    quint32 maximumSyncJumpWidth;
+};
+
+// Derives prescaler, segments and synchronization jump width from a bit
+// rate and sample point, in the spirit of the Linux can_calc_bittiming().
+// Every prescaler is tried, the one with the smallest bit rate error wins,
+// then the one coming closest to the sample point, then the one with the
+// most quanta per bit.
+class KvaserBitTimingCalculator
+{
+public:
+    // Controller clock of the Kvaser CAN FD devices, assumed when the
+    // driver cannot tell
+    static constexpr quint32 defaultClockFrequency = 80000000;
+    // Oscillator tolerance of ISO 11898-1 is below 1.58 percent for both
+    // nodes together, the bit rate itself should use little of it
+    static constexpr double maximumBitRateError = 0.005;
+
+    // Common subsets of the ranges of the Kvaser controllers: kvBusParamsTq
+    // for the arbitration and data phase, the tseg arguments of
+    // canSetBusParams() for classic CAN. The driver derives the prescaler
+    // from the tseg arguments itself, so it is not limited for those.
+    static constexpr KvaserBitTimingLimits arbitrationLimits = { 1, 512, 1, 255, 1, 128, 128 };
+    static constexpr KvaserBitTimingLimits dataLimits = { 1, 32, 1, 31, 1, 16, 16 };
+    static constexpr KvaserBitTimingLimits classicLimits = { 1, 8192, 1, 16, 1, 8, 4 };
+
+    // samplePoint is a fraction of the bit, like 0.875. Returns false if no
+    // timing comes within maximumBitRateError of the bit rate.
+    static bool calculate(quint32 clockFrequency, quint32 bitRate, double samplePoint,
+                          const KvaserBitTimingLimits &limits, KvaserBitTiming *timing);
+    static QString format(const KvaserBitTiming &timing);
+};
+
+QT_END_NAMESPACE
+
+#endif // KVASERCANTIMING_P_H
@@ -0,0 +1,153 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanbackend.h"
+#include "fakecanlib.h"
+
+#include <QtTest/qtest.h>
+
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qloggingcategory.h>
+
+#include <thread>
+#include <vector>
+
+QT_BEGIN_NAMESPACE
+Q_LOGGING_CATEGORY(QT_CANBUS_PLUGINS_KVASERCAN, "qt.canbus.plugins.kvasercan")
+QT_END_NAMESPACE
+
+// Frames each sender thread puts on the bus, the total stays below the
+// default receive queue size of the fake so no frame is lost to an overrun
+static const int framesPerSender = 10000;
+static const int senderCount = 4;
+
+class tst_KvaserCanBackend : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void notificationStress_data();
+    void notificationStress();
+};
+
+void tst_KvaserCanBackend::initTestCase()
+{
+    QString errorReason;
+    QVERIFY2(KvaserCanBackend::canCreate(&errorReason), qPrintable(errorReason));
+    QVERIFY(!KvaserCanBackend::interfaces().isEmpty());
+}
+
+void tst_KvaserCanBackend::cleanup()
+{
+    fakeCanlibReset();
+}
+
+void tst_KvaserCanBackend::notificationStress_data()
+{
+    QTest::addColumn<bool>("receiveThread");
+    QTest::addColumn<uint>("batchSize");
+    QTest::addColumn<uint>("batchTimeout");
+
+    QTest::newRow("unbatched") << false << 0u << 0u;
+    QTest::newRow("size") << false << 64u << 0u;
+    QTest::newRow("timeout") << false << 0u << 1000u;
+    QTest::newRow("size and timeout") << false << 64u << 1000u;
+    QTest::newRow("receive thread") << true << 0u << 0u;
+}
+
+// Several threads call the CANLIB notification at the same time, as the
+// fake runs it on the sending thread. A lost wakeup leaves frames in the
+// driver queue, a duplicated one shows as a drain that found nothing.
+void tst_KvaserCanBackend::notificationStress()
+{
+    QFETCH(bool, receiveThread);
+    QFETCH(uint, batchSize);
+    QFETCH(uint, batchTimeout);
+
+    KvaserCanBackend device(KvaserCanBackend::interfaces().first().name());
+    device.setConfigurationParameter(KvaserCanBackend::ReceiveThreadKey, receiveThread);
+    device.setConfigurationParameter(KvaserCanBackend::ReceiveBatchSizeKey, batchSize);
+    device.setConfigurationParameter(KvaserCanBackend::ReceiveBatchTimeoutKey, batchTimeout);
+
+    qint64 received = 0;
+    int deliveries = 0;
+    connect(&device, &QCanBusDevice::framesReceived, this, [&]() {
+        received += device.readAllFrames().size();
+        ++deliveries;
+    });
+    QVERIFY(device.connectDevice());
+    QCOMPARE(device.state(), QCanBusDevice::ConnectedState);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    std::vector<std::thread> senders;
+    for (int sender = 0; sender < senderCount; ++sender) {
+        senders.emplace_back([sender]() {
+            const char payload[8] = {};
+            for (int frame = 0; frame < framesPerSender; ++frame)
+                fakeCanlibTransmit(0x100 + sender, payload, sizeof(payload), 0);
+        });
+    }
+    // The event loop drains while the senders are still running
+    const qint64 total = qint64(senderCount) * framesPerSender;
+    QTRY_VERIFY_WITH_TIMEOUT(received >= total, 10000);
+    for (std::thread &sender : senders)
+        sender.join();
+
+    // Nothing may be left behind or arrive twice. A size without a timeout
+    // delivers a partial batch at most every 10 ms.
+    QTest::qWait(50);
+    QCOMPARE(received, total);
+    if (batchSize > 0 && batchTimeout == 0)
+        QVERIFY(deliveries <= total / batchSize + elapsed.elapsed() / 10 + 1);
+
+    // Every drain that finds nothing was posted by a notification that
+    // arrived while a drain which did find its frame was running
+    const KvaserCanBackend::Statistics statistics = device.statistics();
+    QCOMPARE(qint64(statistics.receivedFrames), total);
+    const quint64 emptyDrains = statistics.drainBatchSizes[0];
+    QVERIFY2(emptyDrains <= statistics.drains - emptyDrains,
+             qPrintable(QStringLiteral("%1 of %2 drains were empty")
+                        .arg(emptyDrains).arg(statistics.drains)));
+
+    device.disconnectDevice();
+}
+
+QTEST_GUILESS_MAIN(tst_KvaserCanBackend)
+
+#include "tst_kvasercanbackend.moc"
@@ -0,0 +1,217 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "kvasercanbackend.h"
+#include "kvasercancapture_p.h"
+#include "fakecanlib.h"
+
+#include <QtTest/qsignalspy.h>
+#include <QtTest/qtest.h>
+
+#include <QtCore/qfile.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qtemporarydir.h>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+Q_LOGGING_CATEGORY(QT_CANBUS_PLUGINS_KVASERCAN, "qt.canbus.plugins.kvasercan")
+QT_END_NAMESPACE
+
+namespace {
+
+// The frames every trace below holds, 10 ms apart, with malformed lines
+// or records between them
+struct TraceFrame
+{
+    quint32 id;
+    bool extended;
+    QByteArray payload;
+};
+
+QList<TraceFrame> traceFrames()
+{
+    return {
+        { 0x123, false, QByteArray::fromHex("01020304") },
+        { 0x1ABCDEF0, true, QByteArray::fromHex("deadbeef00112233") },
+        { 0x7FF, false, QByteArray() },
+    };
+}
+
+// A length above the payload size makes a corrupt record
+void appendCaptureRecord(QByteArray *data, quint32 id, quint32 flags, const QByteArray &payload,
+                         qint64 timestamp, int length = -1)
+{
+    const quint32 size = quint32(payload.size());
+    KvaserCaptureFrameRecord record;
+    record.type = KvaserCaptureFrameType;
+    record.size = quint16(sizeof(record) + ((size + 7) & ~7u));
+    record.flags = flags;
+    record.id = id;
+    record.length = quint8(length < 0 ? int(size) : length);
+    record.channel = 0;
+    record.dlc = quint16(size);
+    record.timestamp = timestamp;
+    data->append(reinterpret_cast<const char *>(&record), sizeof(record));
+    data->append(payload);
+    data->append(QByteArray(int(record.size - sizeof(record) - size), '\0'));
+}
+
+QByteArray captureTrace()
+{
+    QByteArray records;
+    appendCaptureRecord(&records, 0x123, KVASER_MESSAGE_STANDARD_FRAME_FORMAT,
+                        QByteArray::fromHex("01020304"), 0);
+    appendCaptureRecord(&records, 0x1ABCDEF0, KVASER_MESSAGE_EXTENDED_FRAME_FORMAT,
+                        QByteArray::fromHex("deadbeef00112233"), 10000);
+    appendCaptureRecord(&records, 0, KVASER_MESSAGE_ERROR_FRAME, QByteArray(), 15000);
+    appendCaptureRecord(&records, 0x124, KVASER_MESSAGE_STANDARD_FRAME_FORMAT,
+                        QByteArray::fromHex("0102"), 17000, 64);
+    appendCaptureRecord(&records, 0x7FF, KVASER_MESSAGE_STANDARD_FRAME_FORMAT, QByteArray(), 20000);
+
+    KvaserCaptureFileHeader header = {};
+    memcpy(header.magic, "KVCAPTR", 8);
+    header.byteOrder = 0x01020304;
+    header.version = 1;
+    header.headerSize = sizeof(header);
+    header.dataEnd = sizeof(header) + quint64(records.size());
+    return QByteArray(reinterpret_cast<const char *>(&header), sizeof(header)) + records;
+}
+
+} // namespace
+
+class tst_KvaserCanReplay : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void replay_data();
+    void replay();
+};
+
+void tst_KvaserCanReplay::initTestCase()
+{
+    QString errorReason;
+    QVERIFY2(KvaserCanBackend::canCreate(&errorReason), qPrintable(errorReason));
+    QVERIFY(KvaserCanBackend::interfaces().size() >= 2);
+}
+
+void tst_KvaserCanReplay::cleanup()
+{
+    fakeCanlibReset();
+}
+
+void tst_KvaserCanReplay::replay_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QByteArray>("trace");
+    QTest::addColumn<quint64>("skippedFrames");
+
+    QTest::newRow("capture") << QStringLiteral("trace.kvcap") << captureTrace() << quint64(2);
+    QTest::newRow("candump") << QStringLiteral("trace.log")
+                             << QByteArray("(1436509052.000000) can0 123#01020304\n"
+                                           "(1436509052.010000) can0 1ABCDEF0#DEADBEEF00112233\n"
+                                           "(1436509052.015000) can0 12G#00\n"
+                                           "(1436509052.017000) can0 124#010\n"
+                                           "(1436509052.020000) can0 7FF#\n")
+                             << quint64(2);
+    QTest::newRow("asc") << QStringLiteral("trace.asc")
+                         << QByteArray("date Fri Oct 16 00:00:00.000 2026\n"
+                                       "base hex  timestamps absolute\n"
+                                       "0.000000 1 123 Rx d 4 01 02 03 04\n"
+                                       "0.010000 1 1ABCDEF0x Rx d 8 DE AD BE EF 00 11 22 33\n"
+                                       "0.015000 1 12G Rx d 1 00\n"
+                                       "0.017000 1 124 Rx d 4 01 02\n"
+                                       "0.020000 1 7FF Rx d 0\n"
+                                       "End TriggerBlock\n")
+                         << quint64(2);
+}
+
+// Replays a trace on the first channel and receives it on the second one
+void tst_KvaserCanReplay::replay()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QByteArray, trace);
+    QFETCH(quint64, skippedFrames);
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString path = directory.filePath(fileName);
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(trace), qint64(trace.size()));
+    file.close();
+
+    const QList<QCanBusDeviceInfo> interfaces = KvaserCanBackend::interfaces();
+    KvaserCanBackend sender(interfaces.at(0).name());
+    KvaserCanBackend receiver(interfaces.at(1).name());
+    QList<QCanBusFrame> received;
+    connect(&receiver, &QCanBusDevice::framesReceived, this, [&]() {
+        received += receiver.readAllFrames();
+    });
+    QVERIFY(sender.connectDevice());
+    QVERIFY(receiver.connectDevice());
+
+    QSignalSpy finished(&sender, &KvaserCanBackend::replayFinished);
+    QVERIFY2(sender.startReplay(path), qPrintable(sender.errorString()));
+    QTRY_COMPARE(finished.count(), 1);
+    QVERIFY(!sender.isReplaying());
+
+    const QList<TraceFrame> expected = traceFrames();
+    QTRY_COMPARE(received.size(), expected.size());
+    for (int i = 0; i < expected.size(); ++i) {
+        const QCanBusFrame &frame = received.at(i);
+        QCOMPARE(frame.frameId(), expected.at(i).id);
+        QCOMPARE(frame.hasExtendedFrameFormat(), expected.at(i).extended);
+        QCOMPARE(frame.frameType(), QCanBusFrame::DataFrame);
+        QCOMPARE(frame.payload(), expected.at(i).payload);
+    }
+
+    const KvaserCanBackend::ReplayStatistics statistics = sender.replayStatistics();
+    QCOMPARE(statistics.frames, quint64(expected.size()));
+    QCOMPARE(statistics.skippedFrames, skippedFrames);
+    QCOMPARE(statistics.writeFailures, quint64(0));
+
+    sender.disconnectDevice();
+    receiver.disconnectDevice();
+}
+
+QTEST_GUILESS_MAIN(tst_KvaserCanReplay)
+
+#include "tst_kvasercanreplay.moc"
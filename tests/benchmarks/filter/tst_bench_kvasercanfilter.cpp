@@ -0,0 +1,151 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanfilter_p.h"
+
+#include <QtTest/qtest.h>
+
+#include <QtCore/qrandom.h>
+
+// Identifiers looked up per benchmark iteration
+static const int lookups = 4096;
+
+class tst_bench_KvaserCanFilter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void match_data();
+    void match();
+};
+
+// Exact matches on random identifiers, extended filters use one of four
+// masks so that the matcher searches several mask groups
+static QList<QCanBusDevice::Filter> randomFilters(int count, bool extended, QRandomGenerator *random)
+{
+    static const quint32 extendedMasks[] = { 0x1FFFFFFF, 0x1FFFFF00, 0x1FFF0000, 0x1F000000 };
+
+    QList<QCanBusDevice::Filter> filters;
+    filters.reserve(count);
+    for (int index = 0; index < count; ++index) {
+        QCanBusDevice::Filter filter;
+        filter.type = QCanBusFrame::DataFrame;
+        if (extended) {
+            filter.frameId = random->bounded(0x20000000u);
+            filter.frameIdMask = extendedMasks[index & 3];
+            filter.format = QCanBusDevice::Filter::MatchExtendedFormat;
+        } else {
+            filter.frameId = random->bounded(0x800u);
+            filter.frameIdMask = 0x7FF;
+            filter.format = QCanBusDevice::Filter::MatchBaseFormat;
+        }
+        filters.append(filter);
+    }
+    return filters;
+}
+
+// How the applications filtered before: every frame is compared with every
+// filter until one matches
+static bool linearAccepts(const QList<QCanBusDevice::Filter> &filters, quint32 frameId, bool extended)
+{
+    const QCanBusDevice::Filter::FormatFilter format = extended
+            ? QCanBusDevice::Filter::MatchExtendedFormat : QCanBusDevice::Filter::MatchBaseFormat;
+    for (const QCanBusDevice::Filter &filter : filters) {
+        if ((filter.format & format) && (frameId & filter.frameIdMask) == (filter.frameId & filter.frameIdMask))
+            return true;
+    }
+    return false;
+}
+
+void tst_bench_KvaserCanFilter::match_data()
+{
+    QTest::addColumn<bool>("linear");
+    QTest::addColumn<bool>("extended");
+    QTest::addColumn<int>("filterCount");
+
+    for (int filterCount : { 1, 8, 64, 512, 4096 }) {
+        for (bool extended : { false, true }) {
+            for (bool linear : { false, true }) {
+                QTest::addRow("%s, %s, %d filters", linear ? "linear scan" : "matcher",
+                              extended ? "extended" : "standard", filterCount)
+                        << linear << extended << filterCount;
+            }
+        }
+    }
+}
+
+// Cost of looking up a batch of identifiers, about half of which pass
+void tst_bench_KvaserCanFilter::match()
+{
+    QFETCH(bool, linear);
+    QFETCH(bool, extended);
+    QFETCH(int, filterCount);
+
+    QRandomGenerator random(filterCount);
+    const QList<QCanBusDevice::Filter> filters = randomFilters(filterCount, extended, &random);
+    KvaserFilterMatcher matcher;
+    matcher.setFilters(filters);
+
+    const quint32 flags = extended ? KVASER_MESSAGE_EXTENDED_FRAME_FORMAT : 0;
+    QList<quint32> frameIds;
+    frameIds.reserve(lookups);
+    for (int index = 0; index < lookups; ++index) {
+        const QCanBusDevice::Filter &filter = filters.at(random.bounded(filterCount));
+        if (index & 1)
+            frameIds.append(filter.frameId);
+        else
+            frameIds.append(random.bounded(extended ? 0x20000000u : 0x800u));
+    }
+
+    int accepted = 0;
+    QBENCHMARK {
+        accepted = 0;
+        for (quint32 frameId : std::as_const(frameIds)) {
+            if (linear ? linearAccepts(filters, frameId, extended) : matcher.accepts(long(frameId), flags))
+                ++accepted;
+        }
+    }
+
+    // Both must agree, or the comparison is meaningless
+    int expected = 0;
+    for (quint32 frameId : std::as_const(frameIds))
+        expected += linearAccepts(filters, frameId, extended) ? 1 : 0;
+    QCOMPARE(accepted, expected);
+}
+
+QTEST_APPLESS_MAIN(tst_bench_KvaserCanFilter)
+
+#include "tst_bench_kvasercanfilter.moc"
@@ -0,0 +1,86 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Calls the fake directly, the backend in the same executable resolves
+// its own copies of the CANLIB symbols.
+#define LINK_LIBKVASERCAN
+#include "kvasercan_symbols_p.h"
+
+#include "baselinedrain.h"
+
+int baselineOpen(int channel)
+{
+    const KvaserHandle handle = canOpenChannel(channel, KVASER_OPEN_ACCEPT_VIRTUAL);
+    if (handle >= 0 && canBusOn(handle) != KvaserStatus::OK) {
+        canClose(handle);
+        return -1;
+    }
+    return handle;
+}
+
+void baselineClose(int handle)
+{
+    canClose(handle);
+}
+
+int baselineDrain(int handle, QList<QCanBusFrame> *queue)
+{
+    QList<QCanBusFrame> newFrames;
+
+    for (;;) {
+        long id;
+        char buffer[64];
+        quint32 dlc;
+        quint32 flags;
+        unsigned long time;
+        if (canRead(handle, &id, buffer, &dlc, &flags, &time) != KvaserStatus::OK)
+            break;
+
+        QCanBusFrame frame;
+        frame.setTimeStamp(QCanBusFrame::TimeStamp::fromMicroSeconds(qint64(time) * 1000));
+        frame.setFrameType(QCanBusFrame::DataFrame);
+        if (flags & KVASER_MESSAGE_REMOTE_REQUEST)
+            frame.setFrameType(QCanBusFrame::RemoteRequestFrame);
+        frame.setExtendedFrameFormat(flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT);
+        frame.setFlexibleDataRateFormat(flags & KVASER_MESSAGE_CANFD);
+        frame.setFrameId(quint32(id));
+        frame.setPayload(QByteArray(buffer, int(qMin(dlc, quint32(sizeof(buffer))))));
+        newFrames.append(frame);
+    }
+
+    queue->append(newFrames);
+    return int(newFrames.size());
+}
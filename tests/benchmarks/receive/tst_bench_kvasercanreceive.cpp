@@ -0,0 +1,174 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "kvasercanbackend.h"
+#include "baselinedrain.h"
+#include "fakecanlib.h"
+
+#include <QtTest/qtest.h>
+
+#include <QtCore/qcoreapplication.h>
+#include <QtCore/qloggingcategory.h>
+
+#include <atomic>
+#include <cstdlib>
+
+QT_BEGIN_NAMESPACE
+Q_LOGGING_CATEGORY(QT_CANBUS_PLUGINS_KVASERCAN, "qt.canbus.plugins.kvasercan")
+QT_END_NAMESPACE
+
+// Counts the heap allocations of the process. Qt allocates the data of
+// QByteArray and QList with malloc() and realloc(), not operator new,
+// which itself ends up in malloc().
+static std::atomic<quint64> heapAllocations{0};
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+
+static const int framesPerDrain = 1000;
+static const int drains = 100;
+
+static void transmitFrames(int payloadSize)
+{
+    const char payload[64] = {};
+    const unsigned int flags = payloadSize > 8 ? KVASER_MESSAGE_CANFD : 0;
+    for (int frame = 0; frame < framesPerDrain; ++frame)
+        fakeCanlibTransmit(0x100 + (frame & 0xFF), payload, unsigned(payloadSize), flags);
+}
+
+class tst_bench_KvaserCanReceive : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void allocationsPerFrame_data();
+    void allocationsPerFrame();
+};
+
+void tst_bench_KvaserCanReceive::initTestCase()
+{
+    QString errorReason;
+    QVERIFY2(KvaserCanBackend::canCreate(&errorReason), qPrintable(errorReason));
+    QVERIFY(!KvaserCanBackend::interfaces().isEmpty());
+}
+
+void tst_bench_KvaserCanReceive::cleanup()
+{
+    fakeCanlibReset();
+}
+
+void tst_bench_KvaserCanReceive::allocationsPerFrame_data()
+{
+    QTest::addColumn<bool>("baseline");
+    QTest::addColumn<int>("payloadSize");
+
+    QTest::newRow("before, classic") << true << 8;
+    QTest::newRow("after, classic") << false << 8;
+    QTest::newRow("after, CAN FD") << false << 64;
+}
+
+// Heap allocations per received frame from reading the driver up to the
+// frames waiting in the queue of the device. The frames are put on the bus
+// and taken from the queue outside of the counted section. A frame with a
+// payload cannot take less than one, the QByteArray it owns.
+void tst_bench_KvaserCanReceive::allocationsPerFrame()
+{
+    QFETCH(bool, baseline);
+    QFETCH(int, payloadSize);
+
+    quint64 allocations = 0;
+    quint64 frames = 0;
+
+    if (baseline) {
+        const int handle = baselineOpen(0);
+        QVERIFY(handle >= 0);
+        for (int drain = 0; drain < drains; ++drain) {
+            QList<QCanBusFrame> queue;
+            transmitFrames(payloadSize);
+            const quint64 before = heapAllocations.load(std::memory_order_relaxed);
+            frames += quint64(baselineDrain(handle, &queue));
+            allocations += heapAllocations.load(std::memory_order_relaxed) - before;
+        }
+        baselineClose(handle);
+    } else {
+        KvaserCanBackend device(KvaserCanBackend::interfaces().first().name());
+        device.setConfigurationParameter(QCanBusDevice::CanFdKey, payloadSize > 8);
+        QVERIFY(device.connectDevice());
+        // The first drain sizes the reused batch
+        transmitFrames(payloadSize);
+        QCoreApplication::processEvents();
+        device.readAllFrames();
+
+        for (int drain = 0; drain < drains; ++drain) {
+            transmitFrames(payloadSize);
+            const quint64 before = heapAllocations.load(std::memory_order_relaxed);
+            QCoreApplication::processEvents();
+            allocations += heapAllocations.load(std::memory_order_relaxed) - before;
+            frames += quint64(device.readAllFrames().size());
+        }
+        device.disconnectDevice();
+    }
+
+    QCOMPARE(frames, quint64(framesPerDrain) * drains);
+    QTest::setBenchmarkResult(double(allocations) / double(frames), QTest::Events);
+}
+
+QTEST_GUILESS_MAIN(tst_bench_KvaserCanReceive)
+
+#include "tst_bench_kvasercanreceive.moc"
@@ -0,0 +1,708 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "fakecanlib.h"
+#include "kvasercan_constants_p.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#define FAKE_ERROR_PARAMETER        (-1)
+#define FAKE_ERROR_NO_MESSAGE       (-2)
+#define FAKE_ERROR_NOT_FOUND        (-3)
+#define FAKE_ERROR_INVALID_HANDLE   (-10)
+#define FAKE_ERROR_NOT_IMPLEMENTED  (-32)
+
+#define FAKE_EXPORT extern "C" Q_DECL_EXPORT
+
+typedef void (*FakeCallback)(KvaserNotifyData *);
+
+namespace {
+
+const int maximumHandles = 64;
+
+struct FakeMessage
+{
+    long id;
+    quint32 dlc;
+    quint32 flags;
+    qint64 time;
+    char payload[64];
+};
+
+struct FakeHandle
+{
+    bool open = false;
+    int channel = -1;
+    bool canFd = false;
+    bool busOn = false;
+    bool receiveOwn = false;
+    bool transmitEcho = true;
+    quint32 microSecondsPerTick = 1000;
+    bool overrun = false;
+    std::deque<FakeMessage> queue;
+    FakeCallback callback = nullptr;
+    void *tag = nullptr;
+    quint32 notifyFlags = 0;
+    quint32 standardCode = 0;
+    quint32 standardMask = 0;
+    quint32 extendedCode = 0;
+    quint32 extendedMask = 0;
+    KvaserBusStatistics statistics = {};
+};
+
+struct FakeChannel
+{
+    unsigned long statusFlags = KVASER_STATUS_ERROR_ACTIVE;
+    quint32 transmitErrors = 0;
+    quint32 receiveErrors = 0;
+};
+
+struct FakeNotification
+{
+    FakeCallback callback;
+    KvaserNotifyData data;
+};
+
+// Everything is guarded by one mutex, the callbacks are called after it
+// was released, so they may call back into the library.
+class FakeBus
+{
+public:
+    FakeBus()
+    {
+        const char *channels = std::getenv("FAKE_CANLIB_CHANNELS");
+        m_channels.resize(size_t(qBound(1, channels ? std::atoi(channels) : 2, 64)));
+        const char *queue = std::getenv("FAKE_CANLIB_QUEUE");
+        m_queueCapacity = size_t(qMax(16, queue ? std::atoi(queue) : 65536));
+        m_handles.resize(maximumHandles);
+    }
+
+    std::mutex mutex;
+
+    int channelCount() const { return int(m_channels.size()); }
+    FakeChannel &channel(int index) { return m_channels[size_t(index)]; }
+
+    FakeHandle *handle(KvaserHandle handle)
+    {
+        if (handle < 0 || handle >= maximumHandles || !m_handles[size_t(handle)].open)
+            return nullptr;
+        return &m_handles[size_t(handle)];
+    }
+
+    KvaserHandle open(int channel, int flags)
+    {
+        for (size_t index = 0; index < m_handles.size(); ++index) {
+            if (!m_handles[index].open) {
+                m_handles[index] = FakeHandle();
+                m_handles[index].open = true;
+                m_handles[index].channel = channel;
+                m_handles[index].canFd = flags & KVASER_OPEN_CANFD;
+                return KvaserHandle(index);
+            }
+        }
+        return FAKE_ERROR_NOT_FOUND;
+    }
+
+    void reset()
+    {
+        for (FakeHandle &handle : m_handles)
+            handle = FakeHandle();
+        for (FakeChannel &channel : m_channels)
+            channel = FakeChannel();
+        writtenFrames.store(0, std::memory_order_relaxed);
+        statusReads.store(0, std::memory_order_relaxed);
+    }
+
+    qint64 microSeconds() const
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now() - m_start).count();
+    }
+
+    // Queues the frame on every handle on bus except the sender, which
+    // only receives it as a transmit acknowledgement
+    void deliver(KvaserHandle sender, const FakeMessage &message, std::vector<FakeNotification> *notifications)
+    {
+        const int senderChannel = sender >= 0 ? m_handles[size_t(sender)].channel : -1;
+        for (size_t index = 0; index < m_handles.size(); ++index) {
+            FakeHandle &receiver = m_handles[index];
+            if (!receiver.open || !receiver.busOn)
+                continue;
+            FakeMessage received = message;
+            if (KvaserHandle(index) == sender) {
+                if (!receiver.receiveOwn)
+                    continue;
+                received.flags |= KVASER_MESSAGE_TRANSMIT_ACKNOWLEDGE;
+            } else if (receiver.channel == senderChannel && !receiver.transmitEcho) {
+                continue;
+            } else if (!accepted(receiver, message)) {
+                continue;
+            }
+            if ((message.flags & KVASER_MESSAGE_CANFD) && !receiver.canFd)
+                continue;
+            if (receiver.queue.size() >= m_queueCapacity) {
+                receiver.overrun = true;
+                continue;
+            }
+            if (receiver.overrun) {
+                received.flags |= KVASER_MESSAGE_ERROR_HW_OVERRUN;
+                receiver.overrun = false;
+            }
+            receiver.queue.push_back(received);
+            count(&receiver.statistics, message);
+            notify(KvaserHandle(index), KVASER_NOTIFY_RX, KVASER_EVENT_RX, notifications);
+        }
+        if (sender >= 0)
+            notify(sender, KVASER_NOTIFY_TX, KVASER_EVENT_TX, notifications);
+    }
+
+    void notify(KvaserHandle handle, quint32 notifyFlag, int eventType, std::vector<FakeNotification> *notifications)
+    {
+        const FakeHandle &target = m_handles[size_t(handle)];
+        if (!target.callback || !(target.notifyFlags & notifyFlag))
+            return;
+        FakeNotification notification;
+        memset(&notification.data, 0, sizeof(notification.data));
+        notification.callback = target.callback;
+        notification.data.tag = target.tag;
+        notification.data.eventType = eventType;
+        if (eventType == KVASER_EVENT_STATUS || eventType == KVASER_EVENT_BUSONOFF) {
+            const FakeChannel &channel = m_channels[size_t(target.channel)];
+            notification.data.info.status.busStatus = (unsigned char)channel.statusFlags;
+            notification.data.info.status.txErrorCounter = (unsigned char)qMin(channel.transmitErrors, 255u);
+            notification.data.info.status.rxErrorCounter = (unsigned char)qMin(channel.receiveErrors, 255u);
+        }
+        notifications->push_back(notification);
+    }
+
+    std::vector<FakeHandle> &handles() { return m_handles; }
+
+    std::atomic<quint64> writtenFrames{0};
+    std::atomic<quint64> statusReads{0};
+
+private:
+    static bool accepted(const FakeHandle &receiver, const FakeMessage &message)
+    {
+        if (message.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT)
+            return (quint32(message.id) & receiver.extendedMask) == (receiver.extendedCode & receiver.extendedMask);
+        return (quint32(message.id) & receiver.standardMask) == (receiver.standardCode & receiver.standardMask);
+    }
+
+    static void count(KvaserBusStatistics *statistics, const FakeMessage &message)
+    {
+        const bool extended = message.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT;
+        if (message.flags & KVASER_MESSAGE_REMOTE_REQUEST)
+            ++(extended ? statistics->extRemote : statistics->stdRemote);
+        else
+            ++(extended ? statistics->extData : statistics->stdData);
+    }
+
+    std::vector<FakeHandle> m_handles;
+    std::vector<FakeChannel> m_channels;
+    size_t m_queueCapacity = 65536;
+    const std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+};
+
+FakeBus &bus()
+{
+    static FakeBus instance;
+    return instance;
+}
+
+void dispatch(const std::vector<FakeNotification> &notifications)
+{
+    for (FakeNotification notification : notifications)
+        notification.callback(&notification.data);
+}
+
+KvaserStatus status(int value)
+{
+    return KvaserStatus(value);
+}
+
+FakeMessage message(long id, const void *payload, quint32 dlc, quint32 flags)
+{
+    FakeMessage message;
+    message.id = id;
+    message.dlc = dlc;
+    message.flags = flags & (KVASER_MESSAGE_REMOTE_REQUEST | KVASER_MESSAGE_STANDARD_FRAME_FORMAT
+                             | KVASER_MESSAGE_EXTENDED_FRAME_FORMAT | KVASER_MESSAGE_CANFD
+                             | KVASER_MESSAGE_BIT_RATE_SWITCH);
+    if (!(message.flags & KVASER_MESSAGE_EXTENDED_FRAME_FORMAT))
+        message.flags |= KVASER_MESSAGE_STANDARD_FRAME_FORMAT;
+    message.time = bus().microSeconds();
+    const quint32 length = qMin(dlc, (flags & KVASER_MESSAGE_CANFD) ? 64u : 8u);
+    memset(message.payload, 0, sizeof(message.payload));
+    if (payload && !(flags & KVASER_MESSAGE_REMOTE_REQUEST))
+        memcpy(message.payload, payload, length);
+    return message;
+}
+
+} // namespace
+
+FAKE_EXPORT void canInitializeLibrary(void)
+{
+    bus();
+}
+
+FAKE_EXPORT KvaserStatus canGetNumberOfChannels(int *channelCount)
+{
+    *channelCount = bus().channelCount();
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canEnumHardwareEx(int *channelCount)
+{
+    return canGetNumberOfChannels(channelCount);
+}
+
+FAKE_EXPORT KvaserStatus canGetChannelData(int channel, KvaserCanGetChannelDataItem item, void *buffer, size_t size)
+{
+    if (channel < 0 || channel >= bus().channelCount())
+        return status(FAKE_ERROR_NOT_FOUND);
+
+    const auto copy = [buffer, size](const void *value, size_t valueSize) {
+        if (size < valueSize)
+            return status(FAKE_ERROR_PARAMETER);
+        memcpy(buffer, value, valueSize);
+        return KvaserStatus::OK;
+    };
+
+    switch (item) {
+    case KvaserCanGetChannelDataItem::Capabilities: {
+        const quint32 capabilities = KVASER_CAPABILITY_VIRTUAL | KVASER_CAPABILITY_CANFD;
+        return copy(&capabilities, sizeof(capabilities));
+    }
+    case KvaserCanGetChannelDataItem::CardChannelNumber: {
+        const quint32 channelOnCard = quint32(channel);
+        return copy(&channelOnCard, sizeof(channelOnCard));
+    }
+    case KvaserCanGetChannelDataItem::CardSerialNumber: {
+        const quint64 serial = 1;
+        return copy(&serial, sizeof(serial));
+    }
+    case KvaserCanGetChannelDataItem::CardUpcNumber: {
+        // EAN 00-00000-00000-0 in the byte order of CANLIB
+        const quint8 ean[8] = {};
+        return copy(ean, sizeof(ean));
+    }
+    case KvaserCanGetChannelDataItem::DeviceProductName: {
+        static const char name[] = "Fake CANLIB virtual channel";
+        return copy(name, sizeof(name));
+    }
+    case KvaserCanGetChannelDataItem::ClockInfo: {
+        const qint32 clockInfo[4] = { 1, 80, 1, 0 };
+        return copy(clockInfo, sizeof(clockInfo));
+    }
+    }
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserHandle canOpenChannel(int channel, int flags)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    if (channel < 0 || channel >= bus().channelCount())
+        return FAKE_ERROR_NOT_FOUND;
+    return bus().open(channel, flags);
+}
+
+FAKE_EXPORT KvaserStatus canClose(KvaserHandle handle)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    *fake = FakeHandle();
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canIoCtl(KvaserHandle handle, quint32 function, void *buffer, quint32 size)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    switch (function) {
+    case KVASER_IOCTL_SET_TIMER_SCALE:
+        if (size < sizeof(quint32) || *static_cast<quint32 *>(buffer) == 0)
+            return status(FAKE_ERROR_PARAMETER);
+        fake->microSecondsPerTick = *static_cast<quint32 *>(buffer);
+        return KvaserStatus::OK;
+    case KVASER_IOCTL_RECEIVE_OWN_KEY:
+        if (size < sizeof(quint32))
+            return status(FAKE_ERROR_PARAMETER);
+        fake->receiveOwn = *static_cast<quint32 *>(buffer) != 0;
+        return KvaserStatus::OK;
+    case KVASER_IOCTL_FLUSH_RX_BUFFER:
+        fake->queue.clear();
+        fake->overrun = false;
+        return KvaserStatus::OK;
+    case KVASER_IOCTL_SET_LOOPBACK:
+        if (size < 1)
+            return status(FAKE_ERROR_PARAMETER);
+        fake->transmitEcho = *static_cast<char *>(buffer) != 0;
+        return KvaserStatus::OK;
+    default:
+        return KvaserStatus::OK;
+    }
+}
+
+// The virtual bus has no bit timing, any parameters are accepted
+FAKE_EXPORT KvaserStatus canSetBusParams(KvaserHandle handle, long, quint32, quint32, quint32, quint32, quint32)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+FAKE_EXPORT KvaserStatus canSetBusParamsFd(KvaserHandle handle, long, quint32, quint32, quint32)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+FAKE_EXPORT KvaserStatus canSetBusParamsTq(KvaserHandle handle, KvaserBusParamsTq)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+FAKE_EXPORT KvaserStatus canSetBusParamsFdTq(KvaserHandle handle, KvaserBusParamsTq, KvaserBusParamsTq)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+FAKE_EXPORT KvaserStatus canSetBusOutputControl(KvaserHandle handle, quint32)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+static KvaserStatus setBusOn(KvaserHandle handle, bool on)
+{
+    std::vector<FakeNotification> notifications;
+    {
+        std::lock_guard<std::mutex> locker(bus().mutex);
+        FakeHandle *fake = bus().handle(handle);
+        if (!fake)
+            return status(FAKE_ERROR_INVALID_HANDLE);
+        if (fake->busOn == on)
+            return KvaserStatus::OK;
+        fake->busOn = on;
+        if (!on)
+            fake->queue.clear();
+        bus().notify(handle, KVASER_NOTIFY_BUSONOFF, KVASER_EVENT_BUSONOFF, &notifications);
+    }
+    dispatch(notifications);
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canBusOn(KvaserHandle handle)
+{
+    return setBusOn(handle, true);
+}
+
+FAKE_EXPORT KvaserStatus canBusOff(KvaserHandle handle)
+{
+    return setBusOn(handle, false);
+}
+
+FAKE_EXPORT KvaserStatus canResetBus(KvaserHandle handle)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    fake->queue.clear();
+    fake->overrun = false;
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus kvSetNotifyCallback(KvaserHandle handle, FakeCallback callback, void *tag, quint32 notifyFlags)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    fake->callback = callback;
+    fake->tag = tag;
+    fake->notifyFlags = callback ? notifyFlags : 0;
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canReadStatus(KvaserHandle handle, unsigned long * const flags)
+{
+    bus().statusReads.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    *flags = fake->busOn ? bus().channel(fake->channel).statusFlags : KVASER_STATUS_BUSOFF;
+    if (!fake->queue.empty())
+        *flags |= KVASER_STATUS_RX_PENDING;
+    if (fake->overrun)
+        *flags |= KVASER_STATUS_HW_OVERRUN;
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canReadErrorCounters(KvaserHandle handle, quint32 *transmitErrors,
+                                              quint32 *receiveErrors, quint32 *overruns)
+{
+    bus().statusReads.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    const FakeChannel &channel = bus().channel(fake->channel);
+    *transmitErrors = channel.transmitErrors;
+    *receiveErrors = channel.receiveErrors;
+    *overruns = quint32(fake->statistics.overruns);
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canRead(KvaserHandle handle, long *id, void *payload, quint32 *dlc,
+                                 quint32 *flags, unsigned long *time)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    if (fake->queue.empty())
+        return KvaserStatus::NoMessages;
+    const FakeMessage &message = fake->queue.front();
+    *id = message.id;
+    *dlc = message.dlc;
+    *flags = message.flags;
+    *time = (unsigned long)(message.time / fake->microSecondsPerTick);
+    if (payload) {
+        const quint32 length = (message.flags & KVASER_MESSAGE_CANFD) ? qMin(message.dlc, 64u) : 8u;
+        memcpy(payload, message.payload, length);
+    }
+    fake->queue.pop_front();
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canWrite(KvaserHandle handle, long id, const void *payload, quint32 dlc, quint32 flags)
+{
+    std::vector<FakeNotification> notifications;
+    {
+        std::lock_guard<std::mutex> locker(bus().mutex);
+        FakeHandle *fake = bus().handle(handle);
+        if (!fake)
+            return status(FAKE_ERROR_INVALID_HANDLE);
+        if ((flags & KVASER_MESSAGE_CANFD) && !fake->canFd)
+            return status(FAKE_ERROR_PARAMETER);
+        if (!fake->busOn)
+            return KvaserStatus::OK;
+        bus().writtenFrames.fetch_add(1, std::memory_order_relaxed);
+        bus().deliver(handle, message(id, payload, dlc, flags), &notifications);
+    }
+    dispatch(notifications);
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canSetAcceptanceFilter(KvaserHandle handle, quint32 code, quint32 mask, int extended)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    if (extended) {
+        fake->extendedCode = code;
+        fake->extendedMask = mask;
+    } else {
+        fake->standardCode = code;
+        fake->standardMask = mask;
+    }
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canGetErrorText(KvaserStatus error, char *buffer, size_t size)
+{
+    const char *text = "Unknown error";
+    switch (int(error)) {
+    case 0:
+        text = "No error";
+        break;
+    case FAKE_ERROR_PARAMETER:
+        text = "Error in parameter";
+        break;
+    case FAKE_ERROR_NO_MESSAGE:
+        text = "No messages available";
+        break;
+    case FAKE_ERROR_NOT_FOUND:
+        text = "Specified device not found";
+        break;
+    case FAKE_ERROR_INVALID_HANDLE:
+        text = "Handle is invalid";
+        break;
+    case FAKE_ERROR_NOT_IMPLEMENTED:
+        text = "Not implemented";
+        break;
+    default:
+        break;
+    }
+    if (!buffer || size == 0)
+        return status(FAKE_ERROR_PARAMETER);
+    strncpy(buffer, text, size - 1);
+    buffer[size - 1] = '\0';
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus kvReadTimer64(KvaserHandle handle, qint64 *time)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    *time = bus().microSeconds() / fake->microSecondsPerTick;
+    return KvaserStatus::OK;
+}
+
+FAKE_EXPORT KvaserStatus canRequestBusStatistics(KvaserHandle handle)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    return bus().handle(handle) ? KvaserStatus::OK : status(FAKE_ERROR_INVALID_HANDLE);
+}
+
+FAKE_EXPORT KvaserStatus canGetBusStatistics(KvaserHandle handle, KvaserBusStatistics *statistics, size_t size)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    FakeHandle *fake = bus().handle(handle);
+    if (!fake)
+        return status(FAKE_ERROR_INVALID_HANDLE);
+    if (size < sizeof(KvaserBusStatistics))
+        return status(FAKE_ERROR_PARAMETER);
+    *statistics = fake->statistics;
+    return KvaserStatus::OK;
+}
+
+// The virtual channels have no object buffers, so the backend uses its
+// scheduler thread and receive path responder instead
+FAKE_EXPORT int canObjBufAllocate(KvaserHandle, int)
+{
+    return FAKE_ERROR_NOT_IMPLEMENTED;
+}
+
+FAKE_EXPORT KvaserStatus canObjBufFree(KvaserHandle, int)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufWrite(KvaserHandle, int, int, const void *, quint32, quint32)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufSetPeriod(KvaserHandle, int, quint32)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufEnable(KvaserHandle, int)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufDisable(KvaserHandle, int)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufSetFilter(KvaserHandle, int, quint32, quint32)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT KvaserStatus canObjBufSetFlags(KvaserHandle, int, quint32)
+{
+    return status(FAKE_ERROR_NOT_IMPLEMENTED);
+}
+
+FAKE_EXPORT int fakeCanlibTransmit(long id, const void *payload, unsigned int dlc, unsigned int flags)
+{
+    std::vector<FakeNotification> notifications;
+    {
+        std::lock_guard<std::mutex> locker(bus().mutex);
+        bus().deliver(-1, message(id, payload, dlc, flags), &notifications);
+    }
+    dispatch(notifications);
+    return int(notifications.size());
+}
+
+FAKE_EXPORT void fakeCanlibSetStatus(int channel, unsigned long statusFlags,
+                                     unsigned int transmitErrors, unsigned int receiveErrors)
+{
+    std::vector<FakeNotification> notifications;
+    {
+        std::lock_guard<std::mutex> locker(bus().mutex);
+        if (channel < 0 || channel >= bus().channelCount())
+            return;
+        FakeChannel &fake = bus().channel(channel);
+        fake.statusFlags = statusFlags;
+        fake.transmitErrors = transmitErrors;
+        fake.receiveErrors = receiveErrors;
+        std::vector<FakeHandle> &handles = bus().handles();
+        for (size_t index = 0; index < handles.size(); ++index) {
+            if (handles[index].open && handles[index].channel == channel)
+                bus().notify(KvaserHandle(index), KVASER_NOTIFY_STATUS, KVASER_EVENT_STATUS, &notifications);
+        }
+    }
+    dispatch(notifications);
+}
+
+FAKE_EXPORT unsigned long long fakeCanlibWrittenFrames(void)
+{
+    return bus().writtenFrames.load(std::memory_order_relaxed);
+}
+
+FAKE_EXPORT unsigned long long fakeCanlibStatusReads(void)
+{
+    return bus().statusReads.load(std::memory_order_relaxed);
+}
+
+FAKE_EXPORT void fakeCanlibReset(void)
+{
+    std::lock_guard<std::mutex> locker(bus().mutex);
+    bus().reset();
+}
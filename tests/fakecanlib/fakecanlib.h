@@ -0,0 +1,83 @@
+/****************************************************************************
+**
+** Copyright (C) 2021 Jonas Larsson <jonas.larsson@systemrefine.com>
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtSerialBus module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef FAKECANLIB_H
+#define FAKECANLIB_H
+
+#include <QtCore/qglobal.h>
+
+// Drop-in replacement for the Linux libcanlib.so.1 of Kvaser. It exports
+// every function the plugin resolves in kvasercan_symbols_p.h and connects
+// all channels to one in-memory virtual bus, so the backend runs without
+// hardware or driver. Make it the first libcanlib.so.1 the dynamic linker
+// finds, for example with LD_LIBRARY_PATH, or link the test against it.
+//
+// FAKE_CANLIB_CHANNELS sets the number of channels, 2 by default, and
+// FAKE_CANLIB_QUEUE the receive queue size of every handle, 65536 frames
+// by default. Notifications are called on the thread that caused them,
+// like the CANLIB callback thread they run on without the driver lock held.
+//
+// The functions below control the fake from a test.
+
+#if defined(FAKECANLIB_LIBRARY)
+#  define FAKECANLIB_EXPORT Q_DECL_EXPORT
+#else
+#  define FAKECANLIB_EXPORT Q_DECL_IMPORT
+#endif
+
+extern "C" {
+
+// Puts a frame on the bus as if another node had sent it. Every handle on
+// bus receives it, the return value is the number of handles notified.
+FAKECANLIB_EXPORT int fakeCanlibTransmit(long id, const void *payload, unsigned int dlc, unsigned int flags);
+
+// Changes the bus status flags and error counters of a channel and sends
+// a status notification to every handle of the channel
+FAKECANLIB_EXPORT void fakeCanlibSetStatus(int channel, unsigned long statusFlags,
+                                           unsigned int transmitErrors, unsigned int receiveErrors);
+
+// Frames written with canWrite() since the last reset
+FAKECANLIB_EXPORT unsigned long long fakeCanlibWrittenFrames(void);
+
+// Calls of canReadStatus() and canReadErrorCounters() since the last reset
+FAKECANLIB_EXPORT unsigned long long fakeCanlibStatusReads(void);
+
+// Closes every handle and clears all counters and channel states
+FAKECANLIB_EXPORT void fakeCanlibReset(void);
+
+}
+
+#endif // FAKECANLIB_H